@@ -13,27 +13,47 @@
 
 #include "packsound.h"
 
+#if defined(BURGER_WINDOWS)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #define DOC_28MHZ 28636360.0f			// Master Ensoniq clock rate
 #define DOC_RATE (DOC_28MHZ/32.0f)		// Ensoniq clock rate
 #define SCAN_RATE (DOC_RATE/34.0f)		// All oscillators are enabled
 
+#define IIGS_CLOCK 2800000.0f		// Apple IIgs fast mode clock rate
+#define PACKED_CYCLES 23.5f			// Cycles per sample to expand 4 bit samples in LoadSomeDOCRam
+#define EXPANDED_CYCLES 14.0f		// Cycles per sample to copy pre-expanded samples in CopyDOCPages
+
+#define SOUND_EXPANDED 0x8000U		// Set in m_uDOCRate for pre-expanded samples
+
 struct SpaceAceAudioFile_t {
 	Word16 m_uDOCRate;			// Value to put into the Ensoniq DOC for sample rate
 	Word16 m_uBytesPerTick;		// Number of bytes consumed per 1/60th of a second tick
 	Word8 m_Data[1];			// Raw audio data
 };
 
+struct SpaceAceExpandedAudioFile_t {
+	Word16 m_uDOCRate;			// Value to put into the Ensoniq DOC for sample rate | SOUND_EXPANDED
+	Word16 m_uBytesPerTick;		// Number of bytes consumed per 1/60th of a second tick
+	Word16 m_uPageCount;		// Number of 256 byte pages of samples
+	Word16 m_uSampleCount[2];	// Number of samples before the padding (Low, high)
+	Word8 m_Data[1];			// 8 bit samples with no zeros, ready for DOC ram
+};
+
 static const Word8 g_Lookup[16] = {0x00,0x11,0x22,0x33,0x44,0x55,0x66,0x77,0x88,0x99,0xAA,0xBB,0xCC,0xDD,0xEE,0xFF};
 
 /***************************************
 
-	Process a sound file into 4 bits per sample
+	Check a WAV file and get its sample rate, DOC rate and
+	number of 8 bit samples
 
 ***************************************/
 
-static Word ExtractSound(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength)
+static Word ParseWAVHeader(const Word8 *pInput,WordPtr uInputLength,int *pSampleRate,int *pDOCRate,Word *pSoundLength)
 {
-	if (uInputLength<4) {
+	if (uInputLength<44) {
 		printf("Input is too small\n");
 		return 1;
 	}
@@ -50,14 +70,39 @@ static Word ExtractSound(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr
 	// Calculate the DOC rate
 	int iSampleRate = LittleEndian::Load(reinterpret_cast<const Word32 *>(pInput+24));
 	// Convert from a IIgs step rate to a samples per second rate
-	int iDOCRate = static_cast<int>(((static_cast<float>(iSampleRate)*512.0f)/SCAN_RATE)+0.5f);
+	pDOCRate[0] = static_cast<int>(((static_cast<float>(iSampleRate)*512.0f)/SCAN_RATE)+0.5f);
+	pSampleRate[0] = iSampleRate;
+
+	// Get the number of samples
+	Word uSoundLength = LittleEndian::Load(reinterpret_cast<const Word32 *>(pInput+40));
+	if (uSoundLength>(uInputLength-44)) {
+		printf("Sound file length mismatch\n");
+		return 1;
+	}
+	pSoundLength[0] = uSoundLength;
+	return 0;
+}
+
+/***************************************
+
+	Process a sound file into 4 bits per sample
+
+***************************************/
+
+static Word ExtractSound(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength)
+{
+	int iSampleRate;
+	int iDOCRate;
+	Word uSoundLength;
+	if (ParseWAVHeader(pInput,uInputLength,&iSampleRate,&iDOCRate,&uSoundLength)) {
+		return 1;
+	}
 
 	// Output the Space Ace audio header
 	pOutput->Append(static_cast<Word16>(iDOCRate));
 	pOutput->Append(static_cast<Word16>((iSampleRate+59)/60));
 
-	// WGet the number of samples
-	Word uSoundLength = LittleEndian::Load(reinterpret_cast<const Word32 *>(pInput+40));
+	// Two samples per byte
 	uSoundLength>>=1U;
 	if (uSoundLength) {
 		const Word8 *pTemp = pInput+44;
@@ -70,6 +115,65 @@ static Word ExtractSound(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr
 	return 0;
 }
 
+/***************************************
+
+	Process a sound file into 8 bit samples ready for DOC ram
+
+	Zero samples would stop the DOC, so they are changed to 1.
+	The samples are padded with silence to a multiple of 256 bytes
+	so the player can copy whole pages. The real number of samples
+	is saved so the tools can remove exactly the padding.
+
+***************************************/
+
+static Word ExtractExpandedSound(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength)
+{
+	int iSampleRate;
+	int iDOCRate;
+	Word uSoundLength;
+	if (ParseWAVHeader(pInput,uInputLength,&iSampleRate,&iDOCRate,&uSoundLength)) {
+		return 1;
+	}
+	Word uPageCount = (uSoundLength+255U)>>8U;
+
+	// Output the Space Ace audio header
+	pOutput->Append(static_cast<Word16>(iDOCRate|SOUND_EXPANDED));
+	pOutput->Append(static_cast<Word16>((iSampleRate+59)/60));
+	pOutput->Append(static_cast<Word16>(uPageCount));
+	pOutput->Append(static_cast<Word32>(uSoundLength));
+
+	const Word8 *pTemp = pInput+44;
+	Word i = 0;
+	if (uSoundLength) {
+		do {
+			Word8 uSample = pTemp[i];
+			if (!uSample) {
+				uSample = 1;
+			}
+			pOutput->Append(uSample);
+		} while (++i<uSoundLength);
+	}
+	// Pad with silence
+	while (i<(uPageCount<<8U)) {
+		pOutput->Append(static_cast<Word8>(0x80));
+		++i;
+	}
+
+	// Report the cost and the savings
+	Word uPackedSize = (uSoundLength>>1U)+4;
+	Word uExpandedSize = (uPageCount<<8U)+10;
+	float fCyclesPerTick = (static_cast<float>(iSampleRate)/60.0f)*(PACKED_CYCLES-EXPANDED_CYCLES);
+	float fSavedTime = (static_cast<float>(uSoundLength)*(PACKED_CYCLES-EXPANDED_CYCLES))/IIGS_CLOCK;
+	printf("%u bytes packed, %u bytes expanded\n",uPackedSize,uExpandedSize);
+	printf("Saves about %u cycles per tick (%.1f%% of the CPU), %.2f seconds over the sound\n",
+		static_cast<Word>(fCyclesPerTick),(fCyclesPerTick*100.0f)/(IIGS_CLOCK/60.0f),fSavedTime);
+	if (fSavedTime>0.0f) {
+		printf("Break even when the disk loads faster than %u bytes per second\n",
+			static_cast<Word>(static_cast<float>(uExpandedSize-uPackedSize)/fSavedTime));
+	}
+	return 0;
+}
+
 /***************************************
 
 	Convert a Space Ace file to a WAV file
@@ -86,9 +190,38 @@ static Word EncapsulateToWAV(OutputMemoryStream *pOutput,const Word8 *pInput,Wor
 	WordPtr uCounter = uInputLength-4;
 
 	int iSampleRate = LittleEndian::Load(&reinterpret_cast<const SpaceAceAudioFile_t *>(pInput)->m_uDOCRate);
+	Word bExpanded = static_cast<Word>(iSampleRate)&SOUND_EXPANDED;
+	iSampleRate &= ~SOUND_EXPANDED;
 	// Convert from a IIgs step rate to a samples per second rate
 	iSampleRate = static_cast<int>((static_cast<float>(iSampleRate)/512.0f)*SCAN_RATE);
 
+	// Pre-expanded samples are stored as is
+	if (bExpanded) {
+		if (uInputLength<10) {
+			return 10;
+		}
+		pWork = pInput+10;
+		// Remove the padding
+		uCounter = LittleEndian::Load(reinterpret_cast<const Word32 *>(pInput+6));
+		if (uCounter>(uInputLength-10)) {
+			return 10;
+		}
+		pOutput->Append("RIFF");
+		pOutput->Append(static_cast<Word32>(uCounter+44));
+		pOutput->Append("WAVEfmt ");
+		pOutput->Append(static_cast<Word32>(16));				// Chunk size (Minimum)
+		pOutput->Append(static_cast<Word16>(1));				// Format code (PCM)
+		pOutput->Append(static_cast<Word16>(1));				// Mono
+		pOutput->Append(static_cast<Word32>(iSampleRate));		// Samples per second
+		pOutput->Append(static_cast<Word32>(iSampleRate));		// Bytes per second (Same as samples)
+		pOutput->Append(static_cast<Word16>(1));				// Byte aligned
+		pOutput->Append(static_cast<Word16>(8));				// Bits per sample
+		pOutput->Append("data");
+		pOutput->Append(static_cast<Word32>(uCounter));
+		pOutput->Append(pWork,uCounter);
+		return 0;
+	}
+
 	// Trim excess data if needed
 
 	if (uCounter) {
@@ -122,6 +255,83 @@ static Word EncapsulateToWAV(OutputMemoryStream *pOutput,const Word8 *pInput,Wor
 	return 0;
 }
 
+/***************************************
+
+	Stream a Space Ace file as raw unsigned 8 bit PCM
+
+	Samples are written as they are decoded, a block at a time.
+	The sample rate is printed to stderr for the player's
+	command line.
+
+***************************************/
+
+static Word StreamToPCM(FILE *fp,const Word8 *pInput,WordPtr uInputLength)
+{
+	// Too small?
+	if (uInputLength<4) {
+		return 10;
+	}
+	const Word8 *pWork = pInput+4;
+	WordPtr uCounter = uInputLength-4;
+
+	int iSampleRate = LittleEndian::Load(&reinterpret_cast<const SpaceAceAudioFile_t *>(pInput)->m_uDOCRate);
+	Word bExpanded = static_cast<Word>(iSampleRate)&SOUND_EXPANDED;
+	iSampleRate &= ~SOUND_EXPANDED;
+	// Convert from a IIgs step rate to a samples per second rate
+	iSampleRate = static_cast<int>((static_cast<float>(iSampleRate)/512.0f)*SCAN_RATE);
+	fprintf(stderr,"Unsigned 8 bit mono PCM at %d Hz\n",iSampleRate);
+
+	// Pre-expanded samples are already PCM
+	if (bExpanded) {
+		if (uInputLength<10) {
+			return 10;
+		}
+		pWork = pInput+10;
+		uCounter = LittleEndian::Load(reinterpret_cast<const Word32 *>(pInput+6));
+		if (uCounter>(uInputLength-10)) {
+			return 10;
+		}
+		if (uCounter && (fwrite(pWork,1,uCounter,fp)!=uCounter)) {
+			return 10;
+		}
+		fflush(fp);
+		return 0;
+	}
+
+	// Trim excess data if needed
+
+	if (uCounter) {
+		do {
+			if (pWork[uCounter-1]==0x88) {
+				break;
+			}
+		} while (--uCounter);
+	}
+
+	Word8 Buffer[1024];
+	while (uCounter) {
+		WordPtr uChunk = sizeof(Buffer)/2;
+		if (uCounter<uChunk) {
+			uChunk = uCounter;
+		}
+		uCounter-=uChunk;
+		Word8 *pDest = Buffer;
+		WordPtr i = uChunk;
+		do {
+			pDest[0] = g_Lookup[(pWork[0]>>4)&0xF];
+			pDest[1] = g_Lookup[pWork[0]&0xF];
+			pDest+=2;
+			++pWork;
+		} while (--i);
+		if (fwrite(Buffer,1,uChunk*2,fp)!=(uChunk*2)) {
+			// The player was closed
+			return 10;
+		}
+	}
+	fflush(fp);
+	return 0;
+}
+
 /***************************************
 
 	Main dispatcher
@@ -132,10 +342,14 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 {
 	ConsoleApp MyApp(argc,argv);
 	CommandParameterBooleanTrue DoSound("Process Sound","s");
+	CommandParameterBooleanTrue DoExpanded("Process Sound, pre-expanded for DOC ram","d");
 	CommandParameterBooleanTrue DoWave("Convert to Wave","w");
+	CommandParameterBooleanTrue DoPCM("Stream as raw PCM (- for stdout)","pcm");
 	const CommandParameter *MyParms[] = {
 		&DoSound,
-		&DoWave
+		&DoExpanded,
+		&DoWave,
+		&DoPCM
 	};
 
 	argc = MyApp.GetArgc();
@@ -154,7 +368,8 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 		WordPtr uInputLength;
 		Word8 *pInput = static_cast<Word8 *>(FileManager::LoadFile(&InputName,&uInputLength));
 		if (!pInput) {
-			printf("Can't open %s!\n",argv[1]);
+			// Keep a -pcm stream on stdout clean
+			fprintf(DoPCM.GetValue() ? stderr : stdout,"Can't open %s!\n",argv[1]);
 			Globals::SetErrorCode(10);
 		} else {
 
@@ -173,6 +388,21 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 					}
 				}
 
+			// Convert wave to DOC ready data
+			} else if (DoExpanded.GetValue()) {
+				OutputMemoryStream Output;
+				if (ExtractExpandedSound(&Output,pInput,uInputLength)) {
+					printf("Can't convert %s!\n",argv[1]);
+					Globals::SetErrorCode(10);
+				} else {
+					Filename OutputName;
+					OutputName.SetFromNative(argv[2]);
+					if (Output.SaveFile(&OutputName)) {
+						printf("Can't save %s!\n",argv[2]);
+						Globals::SetErrorCode(10);
+					}
+				}
+
 			// Convert raw audio to WAV
 			} else if (DoWave.GetValue()) {
 				OutputMemoryStream Output;
@@ -187,6 +417,29 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 						Globals::SetErrorCode(10);
 					}
 				}
+			// Stream raw audio as PCM
+			} else if (DoPCM.GetValue()) {
+				FILE *fp;
+				if (!StringCompare(argv[2],"-")) {
+					fp = stdout;
+#if defined(BURGER_WINDOWS)
+					_setmode(_fileno(stdout),_O_BINARY);
+#endif
+				} else {
+					fp = fopen(argv[2],"wb");
+				}
+				if (!fp) {
+					fprintf(stderr,"Can't save %s!\n",argv[2]);
+					Globals::SetErrorCode(10);
+				} else {
+					if (StreamToPCM(fp,pInput,uInputLength)) {
+						fprintf(stderr,"Can't convert %s!\n",argv[1]);
+						Globals::SetErrorCode(10);
+					}
+					if (fp!=stdout) {
+						fclose(fp);
+					}
+				}
 			} else {
 				printf("No conversion selected for %s!\n",argv[1]);
 				Globals::SetErrorCode(10);
@@ -13,6 +13,17 @@
 
 #include "packvideo.h"
 
+#if defined(BURGER_WINDOWS)
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+#define MAXTHREADS 64		// Maximum number of encoder threads
+#define MINCHUNKSIZE 512	// Smallest -b chunk budget, a palette and a scan line always fit
+
 /***************************************
 
 	Convert the IIgs palette to RGBAWord8_t
@@ -64,16 +75,15 @@ static Word BURGER_API ComparePalette(const Word8 *pInput1,const Word8 *pInput2)
 
 /***************************************
 
-	Convert bitmap to IIgs format
+	Convert 8 bit pixels to IIgs format
 
 	8 bits per pixel converted to 4 bits per pixel
 
 ***************************************/
 
-static void BURGER_API ConvertPixelsToIIgs(Word8 *pOutput,const Image *pInput)
+static void BURGER_API ConvertPixelsToIIgs(Word8 *pOutput,const Word8 *pPixels,WordPtr uStride)
 {
-	WordPtr uStride = pInput->GetStride()-320;
-	const Word8 *pPixels = pInput->GetImage();
+	uStride -= 320;
 	WordPtr j=200;
 	do {
 		WordPtr i=320/2;
@@ -88,6 +98,34 @@ static void BURGER_API ConvertPixelsToIIgs(Word8 *pOutput,const Image *pInput)
 	} while (--j);
 }
 
+/***************************************
+
+	Convert bitmap to IIgs format
+
+***************************************/
+
+static void BURGER_API ConvertPixelsToIIgs(Word8 *pOutput,const Image *pInput)
+{
+	ConvertPixelsToIIgs(pOutput,pInput->GetImage(),pInput->GetStride());
+}
+
+/***************************************
+
+	Append the contents of one memory stream to another
+
+***************************************/
+
+static void BURGER_API AppendStream(OutputMemoryStream *pOutput,const OutputMemoryStream *pInput)
+{
+	WordPtr uLength = pInput->GetSize();
+	if (uLength) {
+		Word8 *pBuffer = static_cast<Word8 *>(Alloc(uLength));
+		pInput->Flatten(pBuffer,uLength);
+		pOutput->Append(pBuffer,uLength);
+		Free(pBuffer);
+	}
+}
+
 /***************************************
 
 	Compress a IIgs keyframe
@@ -166,20 +204,280 @@ static void BURGER_API CompressKeyFrame(OutputMemoryStream *pOutput,const Word8
 	pOutput->Append(static_cast<Word8>(0));
 }
 
+/***************************************
+
+	Compress a IIgs keyframe with LZ copy tokens
+
+	The run tokens are the same as CompressKeyFrame with one more
+	0x80,Length,Low,High = Copy 1-255 bytes from 1-65535 bytes
+	back in this frame
+
+	0x80 is always a copy in the player. CompressKeyFrame never
+	makes an empty fill run, so older pictures don't have it and
+	no chunk flag is needed.
+
+	The copy goes a byte at a time, so it may overlap the bytes
+	it writes. Matches are found with hash chains over the last
+	LZWINDOW bytes. A copy is only used if it's at least LZMINMATCH
+	bytes, since a shorter one doesn't pay for splitting a raw run,
+	and covers at least twice what a fill run would.
+
+	Return non zero if out of memory
+
+***************************************/
+
+#define LZWINDOW 16384		// Farthest back a copy can reach
+#define LZMINMATCH 6		// Shortest copy used
+#define LZMAXMATCH 255		// Longest copy, 0 would be 256 in the player
+#define LZMAXCHAIN 128		// Most earlier matches tested per byte
+#define LZHASHSIZE 4096		// Entries in the hash table (Power of 2)
+#define LZNONE 0xFFFFFFFFU	// End of a hash chain
+
+static Word BURGER_API LZHash(const Word8 *pInput)
+{
+	Word32 uTemp = (static_cast<Word32>(pInput[0])<<16U)|(static_cast<Word32>(pInput[1])<<8U)|pInput[2];
+	return static_cast<Word>((uTemp*0x9E3779B1U)>>20U)&(LZHASHSIZE-1);
+}
+
+static void BURGER_API OutputRaw(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uRun)
+{
+	if (uRun) {
+		pOutput->Append(static_cast<Word8>(uRun));
+		pOutput->Append(pInput,uRun);
+	}
+}
+
+static Word BURGER_API CompressKeyFrameLZ(OutputMemoryStream *pOutput,const Word8 *pInput)
+{
+	// Number of bytes to process
+	const WordPtr uInputLength = 320*200/2;
+
+	Word32 *pHead = static_cast<Word32 *>(Alloc(sizeof(Word32)*LZHASHSIZE));
+	Word32 *pChain = static_cast<Word32 *>(Alloc(sizeof(Word32)*uInputLength));
+	if (!pHead || !pChain) {
+		Free(pChain);
+		Free(pHead);
+		return 10;
+	}
+	MemoryFill(pHead,0xFF,sizeof(Word32)*LZHASHSIZE);
+
+	WordPtr uRawStart = 0;		// First byte of the pending raw run
+	WordPtr uInserted = 0;		// Bytes added to the hash chains
+	WordPtr uIndex = 0;
+	do {
+		// Add the bytes before this one to the hash chains
+		while ((uInserted<uIndex) && ((uInserted+3)<=uInputLength)) {
+			Word uHash = LZHash(pInput+uInserted);
+			pChain[uInserted] = pHead[uHash];
+			pHead[uHash] = static_cast<Word32>(uInserted);
+			++uInserted;
+		}
+
+		WordPtr uRemaining = uInputLength-uIndex;
+
+		// Length of a fill run
+		WordPtr uMaximumRun = (uRemaining<127) ? uRemaining : 127;
+		WordPtr uRun = 1;
+		while ((uRun<uMaximumRun) && (pInput[uIndex+uRun]==pInput[uIndex])) {
+			++uRun;
+		}
+
+		// Longest copy from earlier in the frame
+		WordPtr uMatch = 0;
+		WordPtr uDistance = 0;
+		if (uRemaining>=LZMINMATCH) {
+			WordPtr uMaximumMatch = (uRemaining<LZMAXMATCH) ? uRemaining : LZMAXMATCH;
+			Word32 uPosition = pHead[LZHash(pInput+uIndex)];
+			Word uChain = LZMAXCHAIN;
+			while ((uPosition!=LZNONE) && ((uIndex-uPosition)<=LZWINDOW) && uChain) {
+				// Can this beat the best so far?
+				if (pInput[uPosition+uMatch]==pInput[uIndex+uMatch]) {
+					WordPtr uLength = 0;
+					while ((uLength<uMaximumMatch) && (pInput[uPosition+uLength]==pInput[uIndex+uLength])) {
+						++uLength;
+					}
+					if (uLength>uMatch) {
+						uMatch = uLength;
+						uDistance = uIndex-uPosition;
+						if (uLength==uMaximumMatch) {
+							break;
+						}
+					}
+				}
+				uPosition = pChain[uPosition];
+				--uChain;
+			}
+		}
+
+		if ((uMatch>=LZMINMATCH) && (uMatch>=(uRun*2))) {
+			OutputRaw(pOutput,pInput+uRawStart,uIndex-uRawStart);
+			pOutput->Append(static_cast<Word8>(0x80));
+			pOutput->Append(static_cast<Word8>(uMatch));
+			pOutput->Append(static_cast<Word16>(uDistance));
+			uIndex += uMatch;
+			uRawStart = uIndex;
+		} else if (uRun>=3) {
+			OutputRaw(pOutput,pInput+uRawStart,uIndex-uRawStart);
+			pOutput->Append(static_cast<Word8>(0x80|uRun));
+			pOutput->Append(pInput[uIndex]);
+			uIndex += uRun;
+			uRawStart = uIndex;
+		} else {
+			// Add to the raw run
+			++uIndex;
+			if ((uIndex-uRawStart)==127) {
+				OutputRaw(pOutput,pInput+uRawStart,127);
+				uRawStart = uIndex;
+			}
+		}
+	} while (uIndex<uInputLength);
+	OutputRaw(pOutput,pInput+uRawStart,uIndex-uRawStart);
+
+	// Mark the end of compressed data
+	pOutput->Append(static_cast<Word8>(0));
+	Free(pChain);
+	Free(pHead);
+	return 0;
+}
+
+/***************************************
+
+	Estimate the cycles UnpackPicSlow takes to draw a keyframe
+
+	Rough counts of its 8 bit loops, per token and per byte
+
+***************************************/
+
+static WordPtr BURGER_API EstimateKeyFrameCycles(const OutputMemoryStream *pInput)
+{
+	WordPtr uLength = pInput->GetSize();
+	Word8 *pBuffer = static_cast<Word8 *>(Alloc(uLength));
+	if (!pBuffer) {
+		return 0;
+	}
+	pInput->Flatten(pBuffer,uLength);
+	const Word8 *pWork = pBuffer;
+	WordPtr uCycles = 0;
+	for (;;) {
+		Word uTemp = pWork[0];
+		uCycles += 11;
+		if (!uTemp) {
+			break;
+		}
+		if (uTemp==0x80) {
+			uCycles += 60+(pWork[1]*23U);
+			pWork += 4;
+		} else if (uTemp&0x80) {
+			uCycles += 17+((uTemp&0x7FU)*16U);
+			pWork += 2;
+		} else {
+			uCycles += 8+(uTemp*26U);
+			pWork += uTemp+1;
+		}
+	}
+	Free(pBuffer);
+	return uCycles;
+}
+
+/***************************************
+
+	Compress a keyframe, also with LZ copies if bLZ is set
+
+	The smaller one is kept and both are reported. If there
+	isn't enough memory for LZ, the runs are used.
+
+***************************************/
+
+static void BURGER_API CompressKeyFrameBest(OutputMemoryStream *pOutput,const Word8 *pInput,Word bLZ)
+{
+	OutputMemoryStream Runs;
+	CompressKeyFrame(&Runs,pInput);
+	OutputMemoryStream LZ;
+	if (!bLZ || CompressKeyFrameLZ(&LZ,pInput)) {
+		AppendStream(pOutput,&Runs);
+	} else {
+		WordPtr uRunsSize = Runs.GetSize();
+		WordPtr uLZSize = LZ.GetSize();
+		printf("Keyframe is %u bytes (About %u cycles) with runs, %u bytes (About %u cycles) with LZ copies\n",
+			static_cast<Word>(uRunsSize),static_cast<Word>(EstimateKeyFrameCycles(&Runs)),
+			static_cast<Word>(uLZSize),static_cast<Word>(EstimateKeyFrameCycles(&LZ)));
+		if (uLZSize<uRunsSize) {
+			AppendStream(pOutput,&LZ);
+		} else {
+			AppendStream(pOutput,&Runs);
+		}
+	}
+}
+
+/***************************************
+
+	Output a version 2 skip token for a run of unchanged bytes
+
+	Version 2 adds two tokens to the version 1 skip token (1-127)
+	0x80,N = Skip N scan lines (N*160 bytes)
+	0x00,0x00,Low,High = Skip 1-65535 bytes
+
+	The smallest encoding is chosen, ties go to the long skip
+	since it's a single token to dispatch.
+
+***************************************/
+
+static void BURGER_API OutputSkip(OutputMemoryStream *pOutput,WordPtr uRun)
+{
+	if (uRun<128) {
+		pOutput->Append(static_cast<Word8>(uRun));
+	} else {
+		// Scan lines and the remainder
+		WordPtr uLines = uRun/160;
+		WordPtr uRemainder = uRun-(uLines*160);
+		WordPtr uLineSize = 0;
+		if (uLines) {
+			uLineSize = 2;
+		}
+		if (uRemainder) {
+			++uLineSize;
+			if (uRemainder>=128) {
+				++uLineSize;
+			}
+		}
+		// A 4 byte line skip is always 3 tokens, so a tie goes to the long skip
+		if (uLineSize<4) {
+			if (uLines) {
+				pOutput->Append(static_cast<Word8>(0x80));
+				pOutput->Append(static_cast<Word8>(uLines));
+			}
+			if (uRemainder>=128) {
+				pOutput->Append(static_cast<Word8>(127));
+				uRemainder-=127;
+			}
+			if (uRemainder) {
+				pOutput->Append(static_cast<Word8>(uRemainder));
+			}
+		} else {
+			pOutput->Append(static_cast<Word8>(0));
+			pOutput->Append(static_cast<Word8>(0));
+			pOutput->Append(static_cast<Word16>(uRun));
+		}
+	}
+}
+
 /***************************************
 
 	Compress a IIgs animation frame
 
+	If bVersion2 is TRUE, skips are not limited to 127 bytes
+	and are output with OutputSkip()
+
 ***************************************/
 
-static void BURGER_API CompressAnimFrame(OutputMemoryStream *pOutput,const Word8 *pPreviousFrame,const Word8 *pCurrentFrame)
+static void BURGER_API CompressAnimFrame(OutputMemoryStream *pOutput,const Word8 *pPreviousFrame,const Word8 *pCurrentFrame,Word bVersion2)
 {
 	// Number of bytes to process
 	WordPtr uInputLength = 320*200/2;
 	do {
 		// Check if there were any differences between the frames to create a skip token
 		WordPtr uMaximumRun = 127;		// Skip token maximum value
-		if (uInputLength<uMaximumRun) {
+		if (bVersion2 || (uInputLength<uMaximumRun)) {
 			uMaximumRun = uInputLength;
 		}
 
@@ -196,7 +494,11 @@ static void BURGER_API CompressAnimFrame(OutputMemoryStream *pOutput,const Word8
 		if ((uRun==uInputLength) || (uRun>=3)) {
 
 			// Output a "skip" data token
-			pOutput->Append(static_cast<Word8>(uRun));
+			if (bVersion2) {
+				OutputSkip(pOutput,uRun);
+			} else {
+				pOutput->Append(static_cast<Word8>(uRun));
+			}
 			pPreviousFrame+=uRun;
 			pCurrentFrame+=uRun;
 			uInputLength-=uRun;
@@ -301,180 +603,237 @@ static void BURGER_API CompressAnimFrame(OutputMemoryStream *pOutput,const Word8
 
 /***************************************
 
-	Process a video file into space ace format
+	Step to the next chunk in a Space Ace video file
+
+	Return 0 with the chunk in ppChunk/pChunkSize (Without the
+	length word), 1 at the end of data or 10 on a data error
 
 ***************************************/
 
-static Word ExtractVideo(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength)
+static Word BURGER_API NextChunk(const Word8 **ppInput,WordPtr *pInputLength,const Word8 **ppChunk,WordPtr *pChunkSize)
 {
-	InputMemoryStream InputMem(pInput,uInputLength,TRUE);
-	Image MyImage;
-	FileGIF Giffy;
-	Word8 IIgsPalette[32];
-	Word8 NewIIgsPalette[32];
-	Word uResult = 10;
-	if (!Giffy.Load(&MyImage,&InputMem)) {
-
-		if ((MyImage.GetWidth()!=320) || (MyImage.GetHeight()!=200)) {
-			printf("Input file is not 320 x 200");
-		} else {
-			// Initialize the IIgs palette to invalid values
-			MemoryFill(IIgsPalette,255,sizeof(IIgsPalette));
-			Word8 *pCurrentFrame = static_cast<Word8 *>(Alloc(320*200/2));
-			Word8 *pPreviousFrame = static_cast<Word8 *>(Alloc(320*200/2));
-			int i = 1;
-			do {
+	const Word8 *pInput = ppInput[0];
+	WordPtr uInputLength = pInputLength[0];
+	if (uInputLength<2) {
+		fprintf(stderr,"Premature end of data\n");
+		return 10;
+	}
+	Word uChunkSize = LittleEndian::LoadAny(reinterpret_cast<const Word16 *>(pInput));
+	if (uChunkSize>=0xFF00) {
+		return 1;
+	}
+	if (uChunkSize>uInputLength) {
+		fprintf(stderr,"Premature end of data\n");
+		return 10;
+	}
+	if (uChunkSize<2) {
+		fprintf(stderr,"Chunk size too small\n");
+		return 10;
+	}
+//	printf("Chunk is %u bytes\n",uChunkSize);
+	ppChunk[0] = pInput+2;
+	pChunkSize[0] = uChunkSize-2;
+	ppInput[0] = pInput+uChunkSize;
+	pInputLength[0] = uInputLength-uChunkSize;
+
+	// Chunks drawn over another movie can't be shown on their own,
+	// use the picture chunk that follows instead
+	if ((uChunkSize>2) && (pInput[2]&0x04)) {
+		return NextChunk(ppInput,pInputLength,ppChunk,pChunkSize);
+	}
+	return 0;
+}
 
-				// Process a frame
+/***************************************
 
-				// Save space for the chunk size
-				WordPtr uOutputMark = pOutput->GetSize();
-				pOutput->Append(static_cast<Word16>(0));
+	Bounding box of the pixels a chunk wrote to
 
-				// Convert the palette to IIgs format
-				ConvertPalette(NewIIgsPalette,Giffy.GetPalette());
+***************************************/
 
-				// Set the default chunk type
+struct DirtyRect_t {
+	Word m_uLeft;		// Leftmost pixel written
+	Word m_uTop;		// Topmost scan line written
+	Word m_uRight;		// Rightmost pixel written +1
+	Word m_uBottom;		// Bottom scan line written +1
+};
 
-				Word8 uTypeFlag = 0x01;
+static void BURGER_API ClearDirtyRect(DirtyRect_t *pDirty)
+{
+	pDirty->m_uLeft = 320;
+	pDirty->m_uTop = 200;
+	pDirty->m_uRight = 0;
+	pDirty->m_uBottom = 0;
+}
 
-				// Is there a palette update?
-				if (ComparePalette(NewIIgsPalette,IIgsPalette)) {
-					MemoryCopy(IIgsPalette,NewIIgsPalette,sizeof(IIgsPalette));
-					uTypeFlag |= 0x80U;
-				}
+static void BURGER_API FillDirtyRect(DirtyRect_t *pDirty)
+{
+	pDirty->m_uLeft = 0;
+	pDirty->m_uTop = 0;
+	pDirty->m_uRight = 320;
+	pDirty->m_uBottom = 200;
+}
 
-				// Initial frame?
-				if (i==1) {
-					uTypeFlag |= 0x60;
-				}
+/***************************************
 
-				// Send the data type byte
-				pOutput->Append(static_cast<Word8>(uTypeFlag));
+	Add a span of written pixels to a dirty rect
 
-				if (uTypeFlag&0x80U) {
-					pOutput->Append(IIgsPalette,32);
-				}
+	A span that crosses a scan line dirties the whole width
 
-				ConvertPixelsToIIgs(pCurrentFrame,&MyImage);
+***************************************/
 
-				if (uTypeFlag&0x40) {
-					CompressKeyFrame(pOutput,pCurrentFrame);
-				} else {
-					CompressAnimFrame(pOutput,pPreviousFrame,pCurrentFrame);
-				}
-				MemoryCopy(pPreviousFrame,pCurrentFrame,320*200/2);
-
-				// Update the chunk size
-				Word16 uChuckShort;
-				LittleEndian::Store(&uChuckShort,static_cast<Word16>(pOutput->GetSize()-uOutputMark));
-				pOutput->Overwrite(&uChuckShort,2,uOutputMark);
-				++i;
-			} while (!Giffy.LoadNextFrame(&MyImage,&InputMem));
-			Free(pCurrentFrame);
-			Free(pPreviousFrame);
-			// Append an "End of data" marker
-			pOutput->Append(static_cast<Word16>(0xFF00U));
-			uResult = 0;
+static void BURGER_API AddDirtySpan(DirtyRect_t *pDirty,WordPtr uStart,WordPtr uEnd)
+{
+	if (pDirty && (uEnd>uStart)) {
+		Word uTop = static_cast<Word>(uStart/320);
+		Word uBottom = static_cast<Word>((uEnd-1)/320);
+		Word uLeft = 0;
+		Word uRight = 320;
+		if (uTop==uBottom) {
+			uLeft = static_cast<Word>(uStart%320);
+			uRight = static_cast<Word>(((uEnd-1)%320)+1);
+		}
+		if (pDirty->m_uLeft>uLeft) {
+			pDirty->m_uLeft = uLeft;
+		}
+		if (pDirty->m_uTop>uTop) {
+			pDirty->m_uTop = uTop;
+		}
+		if (pDirty->m_uRight<uRight) {
+			pDirty->m_uRight = uRight;
+		}
+		if (pDirty->m_uBottom<=uBottom) {
+			pDirty->m_uBottom = uBottom+1;
 		}
-	} else {
-		printf("Gif input file error!\n");
 	}
-	return uResult;
 }
 
 /***************************************
 
-	Convert a Space Ace file to an animated GIF file
-
-***************************************/
-
-static char Name[] = "filexxx.gif";
+	Decompress a Space Ace chunk into a 320x200 8 bit per pixel image
 
-static Word EncapsulateToGIF(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength)
-{
-	// Too small?
-	if (uInputLength<2) {
-		return 10;
-	}
+	If the chunk has a palette, it's converted into pPalette.
+	If pDirty is not NULL, the area that needs to be redrawn is
+	added to it. A new palette or picture dirties the entire screen.
 
-	FileGIF GIF;
-	Image MyImage;
+	Return the chunk's type byte or zero if the chunk is empty
 
-	// Create an initial image
-	MyImage.Init(320,200,Image::PIXELTYPE8BIT);
-	MyImage.ClearBitmap();
-	MemoryClear(GIF.GetPalette(),sizeof(GIF.GetPalette()[0])*256);
+***************************************/
 
-	//
-	// Decompress a chunk
-	//
-	Word uFrame = 0;
-	for (;;) {
-		Word uChunkSize = LittleEndian::LoadAny(reinterpret_cast<const Word16 *>(pInput));
-		if (uChunkSize>=0xFF00) {
-//			printf("End of data, frames = %u\n",uFrame);
-			break;
-		}
-		++uFrame;
-		if (uChunkSize>uInputLength) {
-			printf("Premature end of data\n");
-			return 10;
-		}
-		if (uChunkSize<2) {
-			printf("Chunk size too small\n");
-			return 10;
+static Word BURGER_API UnpackChunk(Image *pImage,RGBAWord8_t *pPalette,DirtyRect_t *pDirty,const Word8 *pWork,WordPtr uChunkSize)
+{
+	// Get the palette token
+
+	Word uType = 0;
+	if (uChunkSize) {
+		uType = pWork[0];
+		++pWork;
+		--uChunkSize;
+//		printf("Token = 0x%02X\n",uType);
+
+		if (uType&0x80) {
+
+			// Clear out the palette
+			MemoryClear(pPalette,sizeof(pPalette[0])*256);
+			ConvertPalette(pPalette,pWork);
+			pWork+=32;
+			uChunkSize-=32;
 		}
-//		printf("Chunk is %u bytes\n",uChunkSize);
-		const Word8 *pWork = pInput+2;
-		uInputLength -= uChunkSize;
-		pInput+= uChunkSize;
-		uChunkSize-=2;
-
-		// Get the palette token
 
-		if (uChunkSize) {
-			Word uType = pWork[0];
-			++pWork;
-			--uChunkSize;
-//			printf("Token = 0x%02X\n",uType);
+		// Every pixel is changed
+		if (pDirty && (uType&0xC0)) {
+			FillDirtyRect(pDirty);
+		}
 
-			if (uType&0x80) {
+		// Full image or animation frame?
+		if (uType&0x40) {
+			Word uTemp;
+			Word8 *pDest = pImage->GetImage();
 
-				// Clear out the palette
-				MemoryClear(GIF.GetPalette(),sizeof(GIF.GetPalette()[0])*256);
-				ConvertPalette(GIF.GetPalette(),pWork);
-				pWork+=32;
-				uChunkSize-=32;
+			for (;;) {
+				uTemp = pWork[0];
+				++pWork;
+				if (!uTemp) {
+					break;
+				}
+				if (uTemp&0x80) {
+					uTemp&=0x7f;
+					if (uTemp) {
+						// Run length compressed loop
+						Word uSecond = pWork[0];
+						++pWork;
+						Word uFirst = uSecond>>4U;
+						uSecond&=0xF;
+						do {
+							pDest[0] = static_cast<Word8>(uFirst);
+							pDest[1] = static_cast<Word8>(uSecond);
+							pDest+=2;
+						} while (--uTemp);
+					} else {
+						// Copy from earlier in the frame, may overlap
+						WordPtr uLength = pWork[0]*2U;
+						WordPtr uDistance = (pWork[1]|(pWork[2]<<8U))*2U;
+						pWork+=3;
+						if (!uLength || (uDistance>static_cast<WordPtr>(pDest-pImage->GetImage()))) {
+							break;
+						}
+						const Word8 *pSource = pDest-uDistance;
+						do {
+							pDest[0] = pSource[0];
+							++pSource;
+							++pDest;
+						} while (--uLength);
+					}
+				} else {
+					// Uncompressed loop
+					do {
+						Word uColor = pWork[0];
+						++pWork;
+						pDest[0] = static_cast<Word8>(uColor>>4U);
+						pDest[1] = static_cast<Word8>(uColor&0xF);
+						pDest+=2;
+					} while (--uTemp);
+				}
 			}
+		} else {
 
-			// Full image or animation frame?
-			if (uType&0x40) {
-				Word uTemp;
-				Word8 *pDest = MyImage.GetImage();
-
-				for (;;) {
+			Word uTemp;
+			Word8 *pBase = pImage->GetImage();
+			Word8 *pDest = pBase;
+			Word8 *pEnd = pDest+(320*200);
+			do {
+				uTemp = pWork[0];
+				++pWork;
+				if (!uTemp) {
 					uTemp = pWork[0];
 					++pWork;
-					if (!uTemp) {
-						break;
+					if (uTemp) {
+						// Run length compressed loop
+						Word uSecond = pWork[0];
+						++pWork;
+						Word uFirst = uSecond>>4U;
+						uSecond&=0xF;
+						AddDirtySpan(pDirty,static_cast<WordPtr>(pDest-pBase),static_cast<WordPtr>(pDest-pBase)+(uTemp*2));
+						do {
+							pDest[0] = static_cast<Word8>(uFirst);
+							pDest[1] = static_cast<Word8>(uSecond);
+							pDest+=2;
+						} while (--uTemp);
+					} else if (uType&0x02) {
+						// Version 2 16 bit skip
+						pDest+=(LittleEndian::LoadAny(reinterpret_cast<const Word16 *>(pWork))*2);
+						pWork+=2;
 					}
-					if (uTemp&0x80) {
-						uTemp&=0x7f;
-						if (uTemp) {
-							// Run length compressed loop
-							Word uSecond = pWork[0];
+				} else if (uTemp&0x80) {
+					uTemp&=0x7f;
+					if (!uTemp) {
+						if (uType&0x02) {
+							// Version 2 scan line skip
+							pDest+=(pWork[0]*320);
 							++pWork;
-							Word uFirst = uSecond>>4U;
-							uSecond&=0xF;
-							do {
-								pDest[0] = static_cast<Word8>(uFirst);
-								pDest[1] = static_cast<Word8>(uSecond);
-								pDest+=2;
-							} while (--uTemp);
 						}
 					} else {
 						// Uncompressed loop
+						AddDirtySpan(pDirty,static_cast<WordPtr>(pDest-pBase),static_cast<WordPtr>(pDest-pBase)+(uTemp*2));
 						do {
 							Word uColor = pWork[0];
 							++pWork;
@@ -483,97 +842,2253 @@ static Word EncapsulateToGIF(OutputMemoryStream *pOutput,const Word8 *pInput,Wor
 							pDest+=2;
 						} while (--uTemp);
 					}
+				} else {
+					pDest+=(uTemp*2);
 				}
-			} else {
-
-				Word uTemp;
-				Word8 *pDest = MyImage.GetImage();
-				Word8 *pEnd = pDest+(320*200);
-				do {
-					uTemp = pWork[0];
-					++pWork;
-					if (!uTemp) {
-						uTemp = pWork[0];
-						++pWork;
-						if (uTemp) {
-							// Run length compressed loop
-							Word uSecond = pWork[0];
-							++pWork;
-							Word uFirst = uSecond>>4U;
-							uSecond&=0xF;
-							do {
-								pDest[0] = static_cast<Word8>(uFirst);
-								pDest[1] = static_cast<Word8>(uSecond);
-								pDest+=2;
-							} while (--uTemp);
-						}
-					} else if (uTemp&0x80) {
-						uTemp&=0x7f;
-						if (uTemp) {
-							// Uncompressed loop
-							do {
-								Word uColor = pWork[0];
-								++pWork;
-								pDest[0] = static_cast<Word8>(uColor>>4U);
-								pDest[1] = static_cast<Word8>(uColor&0xF);
-								pDest+=2;
-							} while (--uTemp);
-						}
-					} else {
-						pDest+=(uTemp*2);
-					}
-				} while (pDest<pEnd);
-			}
-		}
-		if (uFrame==1) {
-			GIF.AnimationSaveStart(pOutput,&MyImage);
+			} while (pDest<pEnd);
 		}
-		GIF.AnimationSaveFrame(pOutput,&MyImage,(100U/8U));
 	}
-	GIF.AnimationSaveFinish(pOutput);
-	return 0;
+	return uType;
 }
 
 /***************************************
 
-	Main dispatcher
+	Options for creating a Space Ace video file
 
 ***************************************/
 
-int BURGER_ANSIAPI main(int argc,const char **argv)
-{
-	ConsoleApp MyApp(argc,argv);
-	CommandParameterBooleanTrue DoVideo("Process Video","v");
-	CommandParameterBooleanTrue ConvertToGIF("Convert to GIF","g");
-	const CommandParameter *MyParms[] = {
-		&DoVideo,
-		&ConvertToGIF
-	};
-	argc = MyApp.GetArgc();
-	argv = MyApp.GetArgv();
-	argc = CommandParameter::Process(argc,argv,MyParms,sizeof(MyParms)/sizeof(MyParms[0]),
-		"Usage: packvideo InputFile OutputFile\n\n"
-		"Preprocess video data for Space Ace IIgs.\nCopyright by Rebecca Ann Heineman\n",3);
-	if (argc<0) {
-		Globals::SetErrorCode(10);
-	} else {
-		MyApp.SetArgc(argc);
+#define MAXREFERENCES 32		// Most screens a death scene can start from
+
+struct ReferenceFrame_t {
+	const Word8 *m_pMovie;			// Packed movie a death scene branches from
+	WordPtr m_uMovieLength;			// Size of the movie in bytes
+	Word m_uScene;					// Scene number of the movie
+	Word m_uFrame;					// Frame counter when the death scene starts
+};
+
+struct VideoSettings_t {
+	const ReferenceFrame_t *m_pReferences;	// Screens the death scene can start from
+	WordPtr m_uReferenceCount;		// Number of entries in m_pReferences
+	Word m_bNoPicture;				// Don't save the first picture, the references cover every start
+	WordPtr m_uMaxChunkSize;		// Largest animation chunk in bytes (0 = No limit)
+	Word m_bVersion2;				// Use version 2 animation tokens
+	Word m_bLZKeyFrames;			// Try LZ copy tokens in keyframes
+	Word m_bDither;					// Ordered dither frame sequences
+	WordPtr m_uThreadCount;			// Number of threads for frame sequences
+};
 
-		Filename InputName;
-		InputName.SetFromNative(argv[1]);
+/***************************************
 
-		WordPtr uInputLength;
-		Word8 *pInput = static_cast<Word8 *>(FileManager::LoadFile(&InputName,&uInputLength));
-		if (!pInput) {
-			printf("Can't open %s!\n",argv[1]);
+	Rebuild the screen of a packed reference movie
+	when a death scene starts
+
+	The chunks are played the way the player does, so frames that
+	were spread out by -b are rebuilt as they're shown. The frame
+	counter counts from 1, which is the first frame
+
+***************************************/
+
+static Word8 * BURGER_API LoadReferenceFrame(const ReferenceFrame_t *pReference)
+{
+	Image MyImage;
+	RGBAWord8_t Palette[256];
+	MyImage.Init(320,200,Image::PIXELTYPE8BIT);
+	MyImage.ClearBitmap();
+
+	const Word8 *pInput = pReference->m_pMovie;
+	WordPtr uInputLength = pReference->m_uMovieLength;
+	const Word8 *pWork;
+	WordPtr uChunkSize;
+	Word uFrame = 0;
+	do {
+		Word uResult = NextChunk(&pInput,&uInputLength,&pWork,&uChunkSize);
+		if (uResult==1) {
+			printf("Reference movie only has %u frames\n",uFrame);
+			return NULL;
+		}
+		if (uResult) {
+			printf("Reference movie is damaged!\n");
+			return NULL;
+		}
+		UnpackChunk(&MyImage,Palette,NULL,pWork,uChunkSize);
+	} while (++uFrame<pReference->m_uFrame);
+
+	Word8 *pFrame = static_cast<Word8 *>(Alloc(320*200/2));
+	if (pFrame) {
+		ConvertPixelsToIIgs(pFrame,&MyImage);
+	}
+	return pFrame;
+}
+
+/***************************************
+
+	Copy a band of scan lines from one frame into another
+
+	The band starts at uStart and wraps around the bottom
+
+***************************************/
+
+static void BURGER_API CopyScanLines(Word8 *pOutput,const Word8 *pInput,Word uStart,Word uCount)
+{
+	if (uCount) {
+		do {
+			MemoryCopy(pOutput+(uStart*160),pInput+(uStart*160),160);
+			if (++uStart==200) {
+				uStart = 0;
+			}
+		} while (--uCount);
+	}
+}
+
+/***************************************
+
+	Compress an animation frame into a byte budget
+
+	If the whole frame doesn't fit, only the band of scan lines
+	starting at the first changed line at or after *pRefreshLine
+	is updated. The rest is sent by the following frames since
+	pPreviousFrame is updated to what the player will show.
+	pTarget is a 320*200/2 byte work buffer.
+
+	Return TRUE if part of the frame was deferred
+
+***************************************/
+
+static Word BURGER_API CompressAnimFrameLimited(OutputMemoryStream *pOutput,Word8 *pPreviousFrame,const Word8 *pCurrentFrame,Word8 *pTarget,Word bVersion2,WordPtr uBudget,Word *pRefreshLine)
+{
+	OutputMemoryStream Frame;
+	CompressAnimFrame(&Frame,pPreviousFrame,pCurrentFrame,bVersion2);
+	if (Frame.GetSize()<=uBudget) {
+		AppendStream(pOutput,&Frame);
+		MemoryCopy(pPreviousFrame,pCurrentFrame,320*200/2);
+		return FALSE;
+	}
+
+	// Start at the first scan line with a change
+	Word uStart = pRefreshLine[0];
+	Word uCount = 200;
+	do {
+		if (MemoryCompare(pPreviousFrame+(uStart*160),pCurrentFrame+(uStart*160),160)) {
+			break;
+		}
+		if (++uStart==200) {
+			uStart = 0;
+		}
+	} while (--uCount);
+
+	// Find the most scan lines that fit
+	Word uLow = 1;
+	Word uHigh = 199;
+	while (uLow<uHigh) {
+		Word uMiddle = (uLow+uHigh+1)>>1U;
+		MemoryCopy(pTarget,pPreviousFrame,320*200/2);
+		CopyScanLines(pTarget,pCurrentFrame,uStart,uMiddle);
+		Frame.Clear();
+		CompressAnimFrame(&Frame,pPreviousFrame,pTarget,bVersion2);
+		if (Frame.GetSize()<=uBudget) {
+			uLow = uMiddle;
+		} else {
+			uHigh = uMiddle-1;
+		}
+	}
+	MemoryCopy(pTarget,pPreviousFrame,320*200/2);
+	CopyScanLines(pTarget,pCurrentFrame,uStart,uLow);
+	Frame.Clear();
+	CompressAnimFrame(&Frame,pPreviousFrame,pTarget,bVersion2);
+	AppendStream(pOutput,&Frame);
+	MemoryCopy(pPreviousFrame,pTarget,320*200/2);
+
+	// Continue from here next frame
+	uStart += uLow;
+	if (uStart>=200) {
+		uStart -= 200;
+	}
+	pRefreshLine[0] = uStart;
+	return TRUE;
+}
+
+/***************************************
+
+	Store the size of a chunk started at uOutputMark
+
+***************************************/
+
+static void BURGER_API FinishChunk(OutputMemoryStream *pOutput,WordPtr uOutputMark)
+{
+	Word16 uChuckShort;
+	LittleEndian::Store(&uChuckShort,static_cast<Word16>(pOutput->GetSize()-uOutputMark));
+	pOutput->Overwrite(&uChuckShort,2,uOutputMark);
+}
+
+/***************************************
+
+	State of a movie being compressed into space ace format
+
+	Frames are given one at a time to EncodeVideoFrame() so a
+	movie never has to be in memory all at once.
+
+***************************************/
+
+struct VideoEncoder_t {
+	OutputMemoryStream *m_pOutput;		// Packed movie being created
+	const VideoSettings_t *m_pSettings;	// Options for the movie
+	Word8 *m_pPreviousFrame;			// Screen the player is showing
+	Word8 *m_pLastFrame;				// Last frame given, for catching up
+	Word8 *m_pTarget;					// Work buffer for split frames
+	OutputMemoryStream m_DeferredFrames;	// Frame numbers that were deferred
+	OutputMemoryStream m_OverFrames;	// Frame numbers with a new palette over the -b limit
+	WordPtr m_uFrameCount;				// Frames compressed so far
+	WordPtr m_uLargest;					// Largest animation chunk
+	Word m_uRefreshLine;				// Where the next deferred update starts
+	Word m_uDeferred;					// Number of frames that were deferred
+	Word m_uOver;						// Number of frames over the -b limit
+	Word8 m_Palette[32];				// Palette the player is using
+};
+
+/***************************************
+
+	Start compressing a movie
+
+	Return non zero if out of memory. ShutdownVideo() must
+	be called either way.
+
+***************************************/
+
+static Word BURGER_API StartVideo(VideoEncoder_t *pEncoder,OutputMemoryStream *pOutput,const VideoSettings_t *pSettings)
+{
+	pEncoder->m_pOutput = pOutput;
+	pEncoder->m_pSettings = pSettings;
+	pEncoder->m_pPreviousFrame = static_cast<Word8 *>(Alloc(320*200/2));
+	pEncoder->m_pLastFrame = static_cast<Word8 *>(Alloc(320*200/2));
+	pEncoder->m_pTarget = static_cast<Word8 *>(Alloc(320*200/2));
+	pEncoder->m_uFrameCount = 0;
+	pEncoder->m_uLargest = 0;
+	pEncoder->m_uRefreshLine = 0;
+	pEncoder->m_uDeferred = 0;
+	pEncoder->m_uOver = 0;
+
+	// Initialize the IIgs palette to invalid values
+	MemoryFill(pEncoder->m_Palette,255,sizeof(pEncoder->m_Palette));
+	if (!pEncoder->m_pPreviousFrame || !pEncoder->m_pLastFrame || !pEncoder->m_pTarget) {
+		printf("Out of memory\n");
+		return 10;
+	}
+	return 0;
+}
+
+/***************************************
+
+	Release the memory used to compress a movie
+
+***************************************/
+
+static void BURGER_API ShutdownVideo(VideoEncoder_t *pEncoder)
+{
+	Free(pEncoder->m_pPreviousFrame);
+	Free(pEncoder->m_pLastFrame);
+	Free(pEncoder->m_pTarget);
+	pEncoder->m_pPreviousFrame = NULL;
+	pEncoder->m_pLastFrame = NULL;
+	pEncoder->m_pTarget = NULL;
+}
+
+/***************************************
+
+	Output the chunks starting a death scene from the screens
+	of the reference movies
+
+	Without m_bNoPicture, a chunk is only kept if it's smaller
+	than the picture, since the picture is saved as well. With it,
+	every chunk is kept and the picture is dropped.
+
+***************************************/
+
+static Word BURGER_API EncodeReferenceFrames(VideoEncoder_t *pEncoder,const Word8 *pFrame,const Word8 *pPalette,WordPtr uKeySize)
+{
+	const VideoSettings_t *pSettings = pEncoder->m_pSettings;
+	WordPtr uAdded = 0;
+	WordPtr uIndex = 0;
+	do {
+		const ReferenceFrame_t *pReference = &pSettings->m_pReferences[uIndex];
+		Word8 *pReferenceFrame = LoadReferenceFrame(pReference);
+		if (!pReferenceFrame) {
+			return 10;
+		}
+
+		// The palette is always sent to start the sound
+		OutputMemoryStream Delta;
+		Delta.Append(static_cast<Word16>(0));
+		Delta.Append(static_cast<Word8>(pSettings->m_bVersion2 ? 0x87U : 0x85U));
+		Delta.Append(static_cast<Word8>(pReference->m_uScene));
+		Delta.Append(static_cast<Word16>(pReference->m_uFrame));
+		Delta.Append(pPalette,32);
+		CompressAnimFrame(&Delta,pReferenceFrame,pFrame,pSettings->m_bVersion2);
+		Free(pReferenceFrame);
+
+		WordPtr uDeltaSize = Delta.GetSize();
+		if (pSettings->m_bNoPicture || (uDeltaSize<uKeySize)) {
+			FinishChunk(&Delta,0);
+			AppendStream(pEncoder->m_pOutput,&Delta);
+			uAdded += uDeltaSize;
+			printf("Starting from scene %u frame %u with %u bytes\n",
+				pReference->m_uScene,pReference->m_uFrame,static_cast<Word>(uDeltaSize));
+		} else {
+			printf("Scene %u frame %u needs %u bytes, using the picture instead\n",
+				pReference->m_uScene,pReference->m_uFrame,static_cast<Word>(uDeltaSize));
+		}
+	} while (++uIndex<pSettings->m_uReferenceCount);
+
+	// Net change of the file size
+	if (pSettings->m_bNoPicture) {
+		printf("Starting screens are %u bytes, the %u byte picture is dropped, the file changes by %d bytes\n",
+			static_cast<Word>(uAdded),static_cast<Word>(uKeySize),static_cast<int>(uAdded)-static_cast<int>(uKeySize));
+	} else {
+		printf("Starting screens add %u bytes to the %u byte picture\n",
+			static_cast<Word>(uAdded),static_cast<Word>(uKeySize));
+	}
+	return 0;
+}
+
+/***************************************
+
+	Compress an IIgs frame into space ace format
+
+	pFrame is 320*200/2 bytes and pPalette is the 32 byte
+	IIgs palette of the frame.
+
+	Chunk type flags
+	0x80 = 32 byte palette follows
+	0x40 = Picture (Otherwise an animation frame)
+	0x20 = First frame
+	0x04 = Animation frame starting from the current screen
+	0x02 = Animation frame uses version 2 skip tokens
+	0x01 = Always set
+
+	A 0x04 chunk has the scene number (byte) and frame counter
+	(word) the screen must be showing after the type byte. Several
+	can be in a row, followed by the picture chunk to use if none
+	of them match. The picture is left out with m_bNoPicture, so
+	-g and -y4m previews of the movie start from a blank screen.
+
+	If m_uMaxChunkSize is set, animation chunks that are too large
+	are spread over several frames. A frame with a new palette
+	can't be, the player has a single palette for the whole screen
+	so the lines updated later would show the wrong colors. Those
+	frames go over the limit and are reported as warnings.
+
+***************************************/
+
+static Word BURGER_API EncodeVideoFrame(VideoEncoder_t *pEncoder,const Word8 *pFrame,const Word8 *pPalette)
+{
+	const VideoSettings_t *pSettings = pEncoder->m_pSettings;
+	OutputMemoryStream *pOutput = pEncoder->m_pOutput;
+	WordPtr uFrame = pEncoder->m_uFrameCount;
+
+	// The first frame is the only picture
+	OutputMemoryStream KeyFrame;
+	if (!uFrame) {
+		CompressKeyFrameBest(&KeyFrame,pFrame,pSettings->m_bLZKeyFrames);
+
+		// Can the first frame be drawn over the reference movies?
+		if (pSettings->m_uReferenceCount) {
+			if (EncodeReferenceFrames(pEncoder,pFrame,pPalette,KeyFrame.GetSize()+2+1+32)) {
+				return 10;
+			}
+
+			// The starting screens replace the picture
+			if (pSettings->m_bNoPicture) {
+				MemoryCopy(pEncoder->m_Palette,pPalette,sizeof(pEncoder->m_Palette));
+				MemoryCopy(pEncoder->m_pPreviousFrame,pFrame,320*200/2);
+				MemoryCopy(pEncoder->m_pLastFrame,pFrame,320*200/2);
+				pEncoder->m_uFrameCount = 1;
+				return 0;
+			}
+		}
+	}
+
+	// Save space for the chunk size
+	WordPtr uOutputMark = pOutput->GetSize();
+	pOutput->Append(static_cast<Word16>(0));
+
+	// Set the default chunk type
+
+	Word8 uTypeFlag = 0x01;
+	if (pSettings->m_bVersion2) {
+		uTypeFlag |= 0x02U;
+	}
+
+	// Is there a palette update?
+	if (ComparePalette(pPalette,pEncoder->m_Palette)) {
+		MemoryCopy(pEncoder->m_Palette,pPalette,sizeof(pEncoder->m_Palette));
+		uTypeFlag |= 0x80U;
+	}
+
+	// Initial frame?
+	if (!uFrame) {
+		uTypeFlag |= 0x60;
+	}
+
+	// Send the data type byte
+	pOutput->Append(static_cast<Word8>(uTypeFlag));
+
+	if (uTypeFlag&0x80U) {
+		pOutput->Append(pEncoder->m_Palette,32);
+	}
+
+	if (uTypeFlag&0x40) {
+		AppendStream(pOutput,&KeyFrame);
+		MemoryCopy(pEncoder->m_pPreviousFrame,pFrame,320*200/2);
+
+	// A new palette recolors the whole screen, so the frame
+	// can't be split or the deferred lines show the wrong colors
+	} else if (pSettings->m_uMaxChunkSize && !(uTypeFlag&0x80U)) {
+		// Budget left after the chunk header
+		WordPtr uUsed = pOutput->GetSize()-uOutputMark;
+		WordPtr uBudget = 0;
+		if (pSettings->m_uMaxChunkSize>uUsed) {
+			uBudget = pSettings->m_uMaxChunkSize-uUsed;
+		}
+		if (CompressAnimFrameLimited(pOutput,pEncoder->m_pPreviousFrame,pFrame,pEncoder->m_pTarget,
+			pSettings->m_bVersion2,uBudget,&pEncoder->m_uRefreshLine)) {
+			++pEncoder->m_uDeferred;
+			pEncoder->m_DeferredFrames.Append(static_cast<Word32>(uFrame+1));
+		}
+	} else {
+		CompressAnimFrame(pOutput,pEncoder->m_pPreviousFrame,pFrame,pSettings->m_bVersion2);
+		MemoryCopy(pEncoder->m_pPreviousFrame,pFrame,320*200/2);
+	}
+
+	// Update the chunk size
+	FinishChunk(pOutput,uOutputMark);
+	WordPtr uChunkSize = pOutput->GetSize()-uOutputMark;
+	if (!(uTypeFlag&0x40) && (pEncoder->m_uLargest<uChunkSize)) {
+		pEncoder->m_uLargest = uChunkSize;
+	}
+	if (pSettings->m_uMaxChunkSize && !(uTypeFlag&0x40) && (uChunkSize>pSettings->m_uMaxChunkSize)) {
+		printf("Warning: Frame %u has a new palette and can't be split, it's %u bytes, over the -b limit of %u bytes!\n",
+			static_cast<Word>(uFrame+1),static_cast<Word>(uChunkSize),static_cast<Word>(pSettings->m_uMaxChunkSize));
+		++pEncoder->m_uOver;
+		pEncoder->m_OverFrames.Append(static_cast<Word32>(uFrame+1));
+	}
+	MemoryCopy(pEncoder->m_pLastFrame,pFrame,320*200/2);
+	pEncoder->m_uFrameCount = uFrame+1;
+	return 0;
+}
+
+/***************************************
+
+	Print the frame numbers saved in a stream
+
+***************************************/
+
+static void BURGER_API PrintFrameList(const char *pTitle,OutputMemoryStream *pFrames,Word uCount)
+{
+	Word32 *pList = static_cast<Word32 *>(Alloc(uCount*sizeof(Word32)));
+	if (pList) {
+		pFrames->Flatten(pList,uCount*sizeof(Word32));
+		printf("%s",pTitle);
+		Word uIndex = 0;
+		do {
+			printf(" %u",static_cast<Word>(LittleEndian::Load(&pList[uIndex])));
+		} while (++uIndex<uCount);
+		printf("\n");
+		Free(pList);
+	}
+}
+
+/***************************************
+
+	Finish compressing a movie
+
+	Frames still catching up from -b are added after the last
+	frame, then the end of data marker
+
+***************************************/
+
+static void BURGER_API FinishVideo(VideoEncoder_t *pEncoder)
+{
+	const VideoSettings_t *pSettings = pEncoder->m_pSettings;
+	OutputMemoryStream *pOutput = pEncoder->m_pOutput;
+
+	// Finish any deferred updates
+	if (pSettings->m_uMaxChunkSize) {
+		Word uCatchUp = 0;
+		while (MemoryCompare(pEncoder->m_pPreviousFrame,pEncoder->m_pLastFrame,320*200/2)) {
+			WordPtr uOutputMark = pOutput->GetSize();
+			pOutput->Append(static_cast<Word16>(0));
+			pOutput->Append(static_cast<Word8>(pSettings->m_bVersion2 ? 0x03U : 0x01U));
+			CompressAnimFrameLimited(pOutput,pEncoder->m_pPreviousFrame,pEncoder->m_pLastFrame,pEncoder->m_pTarget,
+				pSettings->m_bVersion2,pSettings->m_uMaxChunkSize-3,&pEncoder->m_uRefreshLine);
+			FinishChunk(pOutput,uOutputMark);
+			if (pEncoder->m_uLargest<(pOutput->GetSize()-uOutputMark)) {
+				pEncoder->m_uLargest = pOutput->GetSize()-uOutputMark;
+			}
+			++uCatchUp;
+		}
+		Word uDeferred = pEncoder->m_uDeferred;
+		printf("%u of %u frames deferred, %u frames added to catch up, largest animation chunk is %u bytes\n",
+			uDeferred,static_cast<Word>(pEncoder->m_uFrameCount),uCatchUp,static_cast<Word>(pEncoder->m_uLargest));
+		if (uDeferred) {
+			PrintFrameList("Deferred frames:",&pEncoder->m_DeferredFrames,uDeferred);
+		}
+
+		// The limit didn't hold, say so
+		Word uOver = pEncoder->m_uOver;
+		if (uOver) {
+			printf("Warning: %u frames with a new palette are over the -b limit of %u bytes!\n",
+				uOver,static_cast<Word>(pSettings->m_uMaxChunkSize));
+			PrintFrameList("Frames over the limit:",&pEncoder->m_OverFrames,uOver);
+		}
+	}
+	// Append an "End of data" marker
+	pOutput->Append(static_cast<Word16>(0xFF00U));
+}
+
+/***************************************
+
+	Process a video file into space ace format
+
+***************************************/
+
+static Word ExtractVideo(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength,const VideoSettings_t *pSettings)
+{
+	InputMemoryStream InputMem(pInput,uInputLength,TRUE);
+	Image MyImage;
+	FileGIF Giffy;
+	if (Giffy.Load(&MyImage,&InputMem)) {
+		printf("Gif input file error!\n");
+		return 10;
+	}
+	if ((MyImage.GetWidth()!=320) || (MyImage.GetHeight()!=200)) {
+		printf("Input file is not 320 x 200\n");
+		return 10;
+	}
+
+	VideoEncoder_t Encoder;
+	Word8 *pFrame = static_cast<Word8 *>(Alloc(320*200/2));
+	Word uResult = StartVideo(&Encoder,pOutput,pSettings);
+	if (!uResult) {
+		if (!pFrame) {
+			printf("Out of memory\n");
+			uResult = 10;
+		} else {
+			Word8 IIgsPalette[32];
+			do {
+				ConvertPixelsToIIgs(pFrame,&MyImage);
+				ConvertPalette(IIgsPalette,Giffy.GetPalette());
+				uResult = EncodeVideoFrame(&Encoder,pFrame,IIgsPalette);
+			} while (!uResult && !Giffy.LoadNextFrame(&MyImage,&InputMem));
+			if (!uResult) {
+				FinishVideo(&Encoder);
+			}
+		}
+	}
+	ShutdownVideo(&Encoder);
+	Free(pFrame);
+	return uResult;
+}
+
+/***************************************
+
+	Frame sequences
+
+	Frames are 320x200 PNG or binary PPM (P6) files named by a
+	file name pattern. The whole sequence shares one 16 color palette
+	chosen by median cut in the IIgs 4096 color space, so pixels
+	that don't change in the source don't change on the IIgs and
+	animation frames keep their skip runs. The ordered dither only
+	depends on the pixel position for the same reason.
+
+	The dither picks between the two palette entries nearest to
+	the pixel's 12 bit color. The pixel is projected onto the line
+	between them and the Bayer matrix is the threshold of how far
+	along the line it has to be to use the second entry.
+
+	12 bit colors are stored as 0x0RGB like the IIgs palette.
+
+***************************************/
+
+static const Word8 g_BayerMatrix[4*4] = {
+	0,8,2,10,
+	12,4,14,6,
+	3,11,1,9,
+	15,7,13,5
+};
+
+/***************************************
+
+	Round an 8 bit color component to 4 bits
+
+***************************************/
+
+static Word BURGER_API RGB8ToRGB4(Word uColor)
+{
+	return ((uColor*15U)+127U)/255U;
+}
+
+/***************************************
+
+	A frame sequence file name pattern
+
+	The pattern has exactly one %d or %0Nd where the frame
+	number goes, like frames/scene%04d.png
+
+***************************************/
+
+#define SEQUENCENAMESIZE 1024	// Largest file name of a frame
+
+struct SequencePattern_t {
+	const char *m_pPrefix;		// Text before the frame number
+	WordPtr m_uPrefixLength;	// Length of the text before the frame number
+	const char *m_pSuffix;		// Text after the frame number
+	Word m_uDigits;				// Frame numbers are padded with zeros to this many digits
+};
+
+/***************************************
+
+	Parse a -seq file name pattern
+
+***************************************/
+
+static Word BURGER_API ParseSequencePattern(SequencePattern_t *pOutput,const char *pPattern)
+{
+	// Find the only %
+	const char *pPercent = NULL;
+	const char *pWork = pPattern;
+	while (pWork[0]) {
+		if (pWork[0]=='%') {
+			if (pPercent) {
+				printf("%s has more than one %% in it!\n",pPattern);
+				return 10;
+			}
+			pPercent = pWork;
+		}
+		++pWork;
+	}
+
+	// %d or %0Nd
+	Word uDigits = 0;
+	Word uValid = FALSE;
+	if (pPercent) {
+		pWork = pPercent+1;
+		if (pWork[0]=='0') {
+			++pWork;
+			while ((pWork[0]>='0') && (pWork[0]<='9') && (uDigits<100)) {
+				uDigits = (uDigits*10U)+(pWork[0]-'0');
+				++pWork;
+			}
+			uValid = (uDigits!=0);
+		} else {
+			uValid = TRUE;
+		}
+		uValid = uValid && (pWork[0]=='d');
+	}
+	if (!uValid) {
+		printf("%s needs one %%d or %%0Nd for the frame number!\n",pPattern);
+		return 10;
+	}
+
+	// The frame number is 10 digits at most
+	WordPtr uLength = StringLength(pPattern);
+	if ((uLength+uDigits+10)>=SEQUENCENAMESIZE) {
+		printf("%s is too long!\n",pPattern);
+		return 10;
+	}
+	pOutput->m_pPrefix = pPattern;
+	pOutput->m_uPrefixLength = static_cast<WordPtr>(pPercent-pPattern);
+	pOutput->m_pSuffix = pWork+1;
+	pOutput->m_uDigits = uDigits;
+	return 0;
+}
+
+/***************************************
+
+	Create the file name of a frame in a sequence
+
+	pOutput is SEQUENCENAMESIZE bytes
+
+***************************************/
+
+static void BURGER_API SequenceFileName(char *pOutput,const SequencePattern_t *pPattern,Word uFrame)
+{
+	MemoryCopy(pOutput,pPattern->m_pPrefix,pPattern->m_uPrefixLength);
+	pOutput += pPattern->m_uPrefixLength;
+
+	// Convert the number backwards
+	char Digits[10];
+	Word uCount = 0;
+	do {
+		Digits[uCount] = static_cast<char>('0'+(uFrame%10U));
+		uFrame /= 10U;
+		++uCount;
+	} while (uFrame);
+
+	// Pad with zeros
+	Word uPad = pPattern->m_uDigits;
+	while (uPad>uCount) {
+		pOutput[0] = '0';
+		++pOutput;
+		--uPad;
+	}
+	do {
+		--uCount;
+		pOutput[0] = Digits[uCount];
+		++pOutput;
+	} while (uCount);
+	StringCopy(pOutput,pPattern->m_pSuffix);
+}
+
+/***************************************
+
+	Read a number from a PPM header
+
+	Whitespace and # comments are skipped
+
+***************************************/
+
+static Word BURGER_API ReadPPMValue(const Word8 **ppInput,const Word8 *pEnd,Word *pValue)
+{
+	const Word8 *pInput = ppInput[0];
+	for (;;) {
+		if (pInput>=pEnd) {
+			return 10;
+		}
+		Word uTemp = pInput[0];
+		if (uTemp=='#') {
+			do {
+				++pInput;
+			} while ((pInput<pEnd) && (pInput[0]!='\n'));
+		} else if ((uTemp==' ') || (uTemp=='\t') || (uTemp=='\r') || (uTemp=='\n')) {
+			++pInput;
+		} else {
+			break;
+		}
+	}
+	Word uValue = 0;
+	Word uDigits = 0;
+	while ((pInput<pEnd) && (pInput[0]>='0') && (pInput[0]<='9') && (uDigits<6)) {
+		uValue = (uValue*10U)+(pInput[0]-'0');
+		++pInput;
+		++uDigits;
+	}
+	ppInput[0] = pInput;
+	pValue[0] = uValue;
+	return !uDigits || (pInput>=pEnd);
+}
+
+/***************************************
+
+	Convert a binary PPM file to 24 bit RGB
+
+***************************************/
+
+static Word BURGER_API LoadPPM(Word8 *pOutput,const Word8 *pInput,WordPtr uInputLength)
+{
+	const Word8 *pEnd = pInput+uInputLength;
+	pInput += 2;
+	Word uWidth;
+	Word uHeight;
+	Word uMaxValue;
+	if (ReadPPMValue(&pInput,pEnd,&uWidth) ||
+		ReadPPMValue(&pInput,pEnd,&uHeight) ||
+		ReadPPMValue(&pInput,pEnd,&uMaxValue) ||
+		!uMaxValue || (uMaxValue>65535)) {
+		return 10;
+	}
+	if ((uWidth!=320) || (uHeight!=200)) {
+		return 20;
+	}
+	// Skip the single whitespace before the pixels
+	++pInput;
+
+	// Samples over 255 are big endian 16 bit values
+	WordPtr uSampleSize = (uMaxValue>255) ? 2U : 1U;
+	if (static_cast<WordPtr>(pEnd-pInput)<(320*200*3*uSampleSize)) {
+		return 10;
+	}
+	WordPtr i = 320*200*3;
+	do {
+		Word uValue = pInput[0];
+		if (uSampleSize==2) {
+			uValue = (uValue<<8U)|pInput[1];
+		}
+		pOutput[0] = static_cast<Word8>(((uValue*255U)+(uMaxValue>>1U))/uMaxValue);
+		pInput += uSampleSize;
+		++pOutput;
+	} while (--i);
+	return 0;
+}
+
+/***************************************
+
+	Load a PNG or PPM frame as 24 bit RGB
+
+***************************************/
+
+static Word BURGER_API LoadTruecolorFrame(Word8 *pOutput,const char *pFileName)
+{
+	Filename InputName;
+	InputName.SetFromNative(pFileName);
+	WordPtr uInputLength;
+	Word8 *pInput = static_cast<Word8 *>(FileManager::LoadFile(&InputName,&uInputLength));
+	if (!pInput) {
+		printf("Can't open %s!\n",pFileName);
+		return 10;
+	}
+
+	Word uResult = 10;
+	if ((uInputLength>=2) && (pInput[0]=='P') && (pInput[1]=='6')) {
+		uResult = LoadPPM(pOutput,pInput,uInputLength);
+		if (uResult==20) {
+			printf("%s is not 320 x 200\n",pFileName);
+			uResult = 10;
+		} else if (uResult) {
+			printf("PPM file error in %s!\n",pFileName);
+		}
+	} else {
+		InputMemoryStream InputMem(pInput,uInputLength,TRUE);
+		Image MyImage;
+		FilePNG Png;
+		if (Png.Load(&MyImage,&InputMem)) {
+			printf("PNG file error in %s!\n",pFileName);
+		} else if ((MyImage.GetWidth()!=320) || (MyImage.GetHeight()!=200)) {
+			printf("%s is not 320 x 200\n",pFileName);
+		} else {
+			Image::ePixelTypes uType = MyImage.GetType();
+			WordPtr uPixelSize;
+			if (uType==Image::PIXELTYPE8BIT) {
+				uPixelSize = 1;
+			} else if (uType==Image::PIXELTYPE888) {
+				uPixelSize = 3;
+			} else if (uType==Image::PIXELTYPE8888) {
+				uPixelSize = 4;
+			} else {
+				uPixelSize = 0;
+				printf("%s isn't an 8, 24 or 32 bit PNG\n",pFileName);
+			}
+			if (uPixelSize) {
+				const RGBAWord8_t *pPalette = Png.GetPalette();
+				const Word8 *pPixels = MyImage.GetImage();
+				WordPtr uStride = MyImage.GetStride()-(320*uPixelSize);
+				WordPtr j = 200;
+				do {
+					WordPtr i = 320;
+					do {
+						if (uPixelSize==1) {
+							const RGBAWord8_t *pColor = &pPalette[pPixels[0]];
+							pOutput[0] = pColor->m_uRed;
+							pOutput[1] = pColor->m_uGreen;
+							pOutput[2] = pColor->m_uBlue;
+						} else {
+							pOutput[0] = pPixels[0];
+							pOutput[1] = pPixels[1];
+							pOutput[2] = pPixels[2];
+						}
+						pPixels += uPixelSize;
+						pOutput += 3;
+					} while (--i);
+					pPixels += uStride;
+				} while (--j);
+				uResult = 0;
+			}
+		}
+	}
+	Free(pInput);
+	return uResult;
+}
+
+/***************************************
+
+	A slot of a thread processing a frame sequence
+
+	The colors are counted from every m_uStep'th frame starting
+	at m_uStart. Frames are then reloaded one at a time to be
+	mapped to the palette, so only one frame per slot is in
+	memory at once.
+
+***************************************/
+
+struct SequenceWorker_t {
+	Thread m_Thread;				// Worker processing this slot's frames
+	Semaphore m_Ready;				// Released when a frame is ready to map
+	Semaphore m_Done;				// Released when the frame is mapped
+	const SequencePattern_t *m_pPattern;	// Pattern of the file names
+	const Word8 *m_pColorTable;		// 12 bit color to the two nearest palette indexes
+	const Word8 *m_pPalette;		// IIgs palette of the sequence
+	Word8 *m_pRGB;					// 24 bit frame being processed
+	Word8 *m_pIndexes;				// Frame as palette indexes
+	Word8 *m_pFrame;				// Frame in IIgs format
+	Word m_uFirst;					// File number of the first frame
+	Word m_bDither;					// TRUE to ordered dither
+	WordPtr m_uFrameCount;			// Frames in the sequence
+	WordPtr m_uStart;				// First frame to count the colors of
+	WordPtr m_uStep;				// Frames to skip to the next one to count
+	WordPtr m_uFrame;				// Frame to map
+	Word m_bThreaded;				// TRUE if m_Thread is running
+	Word m_bQuit;					// TRUE to stop the worker
+	Word m_bPending;				// TRUE if m_pFrame hasn't been compressed
+	Word m_uError;					// Non zero if a frame didn't load
+	Word32 m_Histogram[4096];		// 12 bit color count of this slot's frames
+};
+
+/***************************************
+
+	Thread entry to count the 12 bit colors of frames
+
+***************************************/
+
+static WordPtr BURGER_API CountSequenceColors(void *pData)
+{
+	SequenceWorker_t *pWorker = static_cast<SequenceWorker_t *>(pData);
+	char FileName[SEQUENCENAMESIZE];
+	MemoryClear(pWorker->m_Histogram,sizeof(pWorker->m_Histogram));
+	pWorker->m_uError = 0;
+	WordPtr uFrame = pWorker->m_uStart;
+	while (uFrame<pWorker->m_uFrameCount) {
+		SequenceFileName(FileName,pWorker->m_pPattern,static_cast<Word>(pWorker->m_uFirst+uFrame));
+		const Word8 *pRGB = pWorker->m_pRGB;
+		if (LoadTruecolorFrame(pWorker->m_pRGB,FileName)) {
+			pWorker->m_uError = 10;
+			break;
+		}
+		WordPtr i = 320*200;
+		do {
+			Word uColor = (RGB8ToRGB4(pRGB[0])<<8U)|(RGB8ToRGB4(pRGB[1])<<4U)|RGB8ToRGB4(pRGB[2]);
+			++pWorker->m_Histogram[uColor];
+			pRGB += 3;
+		} while (--i);
+		uFrame += pWorker->m_uStep;
+	}
+	return 0;
+}
+
+/***************************************
+
+	Reload frame m_uFrame, map it to the palette and
+	convert it to IIgs format
+
+***************************************/
+
+static void BURGER_API MapSequenceFrame(SequenceWorker_t *pWorker)
+{
+	char FileName[SEQUENCENAMESIZE];
+	SequenceFileName(FileName,pWorker->m_pPattern,static_cast<Word>(pWorker->m_uFirst+pWorker->m_uFrame));
+	if (LoadTruecolorFrame(pWorker->m_pRGB,FileName)) {
+		pWorker->m_uError = 10;
+		return;
+	}
+
+	// 8 bit versions of the palette
+	int Colors[16][3];
+	const Word8 *pPalette = pWorker->m_pPalette;
+	Word uIndex = 0;
+	do {
+		Colors[uIndex][0] = static_cast<int>(pPalette[1]&0xFU)*17;
+		Colors[uIndex][1] = static_cast<int>(pPalette[0]>>4U)*17;
+		Colors[uIndex][2] = static_cast<int>(pPalette[0]&0xFU)*17;
+		pPalette += 2;
+	} while (++uIndex<16);
+
+	const Word8 *pColorTable = pWorker->m_pColorTable;
+	const Word8 *pRGB = pWorker->m_pRGB;
+	Word8 *pOutput = pWorker->m_pIndexes;
+	Word y = 0;
+	do {
+		Word x = 0;
+		do {
+			int iRed = pRGB[0];
+			int iGreen = pRGB[1];
+			int iBlue = pRGB[2];
+			const Word8 *pPair = pColorTable+(((RGB8ToRGB4(pRGB[0])<<8U)|(RGB8ToRGB4(pRGB[1])<<4U)|RGB8ToRGB4(pRGB[2]))*2);
+			Word uColor = pPair[0];
+			if (pWorker->m_bDither && (pPair[0]!=pPair[1])) {
+				const int *pNear = Colors[pPair[0]];
+				const int *pFar = Colors[pPair[1]];
+				int iDeltaRed = pFar[0]-pNear[0];
+				int iDeltaGreen = pFar[1]-pNear[1];
+				int iDeltaBlue = pFar[2]-pNear[2];
+				int iLength = (iDeltaRed*iDeltaRed)+(iDeltaGreen*iDeltaGreen)+(iDeltaBlue*iDeltaBlue);
+				int iDot = ((iRed-pNear[0])*iDeltaRed)+((iGreen-pNear[1])*iDeltaGreen)+((iBlue-pNear[2])*iDeltaBlue);
+				// Past (Bayer+0.5)/16 of the way to the far color?
+				int iThreshold = static_cast<int>(g_BayerMatrix[((y&3U)<<2U)+(x&3U)])*2+1;
+				if ((iDot*32)>(iThreshold*iLength)) {
+					uColor = pPair[1];
+				}
+			}
+			pOutput[0] = static_cast<Word8>(uColor);
+			pRGB += 3;
+			++pOutput;
+		} while (++x<320);
+	} while (++y<200);
+	ConvertPixelsToIIgs(pWorker->m_pFrame,pWorker->m_pIndexes,320);
+}
+
+/***************************************
+
+	Worker thread that maps the frames put in its slot
+
+***************************************/
+
+static WordPtr BURGER_API MapSequenceWorker(void *pData)
+{
+	SequenceWorker_t *pWorker = static_cast<SequenceWorker_t *>(pData);
+	for (;;) {
+		pWorker->m_Ready.Acquire();
+		if (pWorker->m_bQuit) {
+			break;
+		}
+		MapSequenceFrame(pWorker);
+		pWorker->m_Done.Release();
+	}
+	return 0;
+}
+
+/***************************************
+
+	Wait for a slot's frame to be mapped and compress it
+	if bEncode is set
+
+***************************************/
+
+static Word BURGER_API FlushSequenceFrame(VideoEncoder_t *pEncoder,SequenceWorker_t *pWorker,const Word8 *pPalette,Word bEncode)
+{
+	Word uResult = 0;
+	if (pWorker->m_bPending) {
+		if (pWorker->m_bThreaded) {
+			pWorker->m_Done.Acquire();
+		}
+		pWorker->m_bPending = FALSE;
+		uResult = pWorker->m_uError;
+		if (!uResult && bEncode) {
+			uResult = EncodeVideoFrame(pEncoder,pWorker->m_pFrame,pPalette);
+		}
+	}
+	return uResult;
+}
+
+/***************************************
+
+	A box of 12 bit colors for the median cut
+
+***************************************/
+
+struct ColorBox_t {
+	Word m_uMin[3];			// Lowest red, green and blue
+	Word m_uMax[3];			// Highest red, green and blue
+	Word64 m_uCount;		// Number of pixels in the box
+};
+
+/***************************************
+
+	Shrink a color box to the colors that are used
+
+***************************************/
+
+static void BURGER_API ShrinkColorBox(ColorBox_t *pBox,const Word32 *pHistogram)
+{
+	Word uMin[3] = {15,15,15};
+	Word uMax[3] = {0,0,0};
+	Word64 uCount = 0;
+	Word r = pBox->m_uMin[0];
+	do {
+		Word g = pBox->m_uMin[1];
+		do {
+			Word b = pBox->m_uMin[2];
+			do {
+				Word32 uPixels = pHistogram[(r<<8U)|(g<<4U)|b];
+				if (uPixels) {
+					uCount += uPixels;
+					Word uComponents[3] = {r,g,b};
+					Word uAxis = 0;
+					do {
+						if (uMin[uAxis]>uComponents[uAxis]) {
+							uMin[uAxis] = uComponents[uAxis];
+						}
+						if (uMax[uAxis]<uComponents[uAxis]) {
+							uMax[uAxis] = uComponents[uAxis];
+						}
+					} while (++uAxis<3);
+				}
+			} while (++b<=pBox->m_uMax[2]);
+		} while (++g<=pBox->m_uMax[1]);
+	} while (++r<=pBox->m_uMax[0]);
+	MemoryCopy(pBox->m_uMin,uMin,sizeof(uMin));
+	MemoryCopy(pBox->m_uMax,uMax,sizeof(uMax));
+	pBox->m_uCount = uCount;
+}
+
+/***************************************
+
+	Choose a 16 color IIgs palette with a median cut
+
+	The box with the most pixels times its longest side is split
+	at the median of that side until there are 16 boxes. Each
+	palette entry is the average color of its box.
+
+	Return the number of colors used
+
+***************************************/
+
+static Word BURGER_API ChoosePalette(Word8 *pPalette,const Word32 *pHistogram)
+{
+	ColorBox_t Boxes[16];
+	Word uBoxCount = 1;
+	Boxes[0].m_uMin[0] = 0;
+	Boxes[0].m_uMin[1] = 0;
+	Boxes[0].m_uMin[2] = 0;
+	Boxes[0].m_uMax[0] = 15;
+	Boxes[0].m_uMax[1] = 15;
+	Boxes[0].m_uMax[2] = 15;
+	ShrinkColorBox(&Boxes[0],pHistogram);
+
+	while (uBoxCount<16) {
+		// Find the box to split
+		ColorBox_t *pBox = NULL;
+		Word uAxis = 0;
+		Word64 uBest = 0;
+		Word uIndex = 0;
+		do {
+			ColorBox_t *pTest = &Boxes[uIndex];
+			Word uTestAxis = 0;
+			Word uSide = pTest->m_uMax[0]-pTest->m_uMin[0];
+			if ((pTest->m_uMax[1]-pTest->m_uMin[1])>uSide) {
+				uTestAxis = 1;
+				uSide = pTest->m_uMax[1]-pTest->m_uMin[1];
+			}
+			if ((pTest->m_uMax[2]-pTest->m_uMin[2])>uSide) {
+				uTestAxis = 2;
+				uSide = pTest->m_uMax[2]-pTest->m_uMin[2];
+			}
+			Word64 uScore = pTest->m_uCount*uSide;
+			if (uScore>uBest) {
+				uBest = uScore;
+				pBox = pTest;
+				uAxis = uTestAxis;
+			}
+		} while (++uIndex<uBoxCount);
+
+		// Every box is a single color?
+		if (!pBox) {
+			break;
+		}
+
+		// Count the pixels in each slice along the axis
+		Word64 Slices[16];
+		MemoryClear(Slices,sizeof(Slices));
+		Word r = pBox->m_uMin[0];
+		do {
+			Word g = pBox->m_uMin[1];
+			do {
+				Word b = pBox->m_uMin[2];
+				do {
+					Word uSlice = (uAxis==0) ? r : ((uAxis==1) ? g : b);
+					Slices[uSlice] += pHistogram[(r<<8U)|(g<<4U)|b];
+				} while (++b<=pBox->m_uMax[2]);
+			} while (++g<=pBox->m_uMax[1]);
+		} while (++r<=pBox->m_uMax[0]);
+
+		// The cut always leaves the last slice in the new box
+		Word uCut = pBox->m_uMin[uAxis];
+		Word64 uTotal = Slices[uCut];
+		while (((uTotal*2)<pBox->m_uCount) && ((uCut+1)<pBox->m_uMax[uAxis])) {
+			++uCut;
+			uTotal += Slices[uCut];
+		}
+
+		ColorBox_t *pNew = &Boxes[uBoxCount];
+		pNew[0] = pBox[0];
+		pNew->m_uMin[uAxis] = uCut+1;
+		pBox->m_uMax[uAxis] = uCut;
+		ShrinkColorBox(pBox,pHistogram);
+		ShrinkColorBox(pNew,pHistogram);
+		++uBoxCount;
+	}
+
+	// Average each box
+	MemoryClear(pPalette,32);
+	Word uIndex = 0;
+	do {
+		const ColorBox_t *pBox = &Boxes[uIndex];
+		Word64 uTotals[3] = {0,0,0};
+		if (pBox->m_uCount) {
+			Word r = pBox->m_uMin[0];
+			do {
+				Word g = pBox->m_uMin[1];
+				do {
+					Word b = pBox->m_uMin[2];
+					do {
+						Word64 uPixels = pHistogram[(r<<8U)|(g<<4U)|b];
+						uTotals[0] += uPixels*r;
+						uTotals[1] += uPixels*g;
+						uTotals[2] += uPixels*b;
+					} while (++b<=pBox->m_uMax[2]);
+				} while (++g<=pBox->m_uMax[1]);
+			} while (++r<=pBox->m_uMax[0]);
+			Word64 uHalf = pBox->m_uCount>>1U;
+			Word uRed = static_cast<Word>((uTotals[0]+uHalf)/pBox->m_uCount);
+			Word uGreen = static_cast<Word>((uTotals[1]+uHalf)/pBox->m_uCount);
+			Word uBlue = static_cast<Word>((uTotals[2]+uHalf)/pBox->m_uCount);
+			pPalette[uIndex*2] = static_cast<Word8>((uGreen<<4U)|uBlue);
+			pPalette[uIndex*2+1] = static_cast<Word8>(uRed);
+		}
+	} while (++uIndex<uBoxCount);
+	return uBoxCount;
+}
+
+/***************************************
+
+	Create the 12 bit color to palette entry table
+
+	Each color has the nearest and second nearest palette
+	entries. With one color they're both entry 0.
+
+***************************************/
+
+static void BURGER_API BuildColorTable(Word8 *pTable,const Word8 *pPalette,Word uColorCount)
+{
+	Word uColor = 0;
+	do {
+		int iRed = static_cast<int>(uColor>>8U);
+		int iGreen = static_cast<int>((uColor>>4U)&0xFU);
+		int iBlue = static_cast<int>(uColor&0xFU);
+		Word uBest = 0;
+		Word uSecond = 0;
+		int iBestDistance = 0x7FFFFFFF;
+		int iSecondDistance = 0x7FFFFFFF;
+		Word uIndex = 0;
+		do {
+			int iTemp = iRed-static_cast<int>(pPalette[uIndex*2+1]&0xFU);
+			int iDistance = iTemp*iTemp;
+			iTemp = iGreen-static_cast<int>(pPalette[uIndex*2]>>4U);
+			iDistance += iTemp*iTemp;
+			iTemp = iBlue-static_cast<int>(pPalette[uIndex*2]&0xFU);
+			iDistance += iTemp*iTemp;
+			if (iDistance<iBestDistance) {
+				iSecondDistance = iBestDistance;
+				uSecond = uBest;
+				iBestDistance = iDistance;
+				uBest = uIndex;
+			} else if (iDistance<iSecondDistance) {
+				iSecondDistance = iDistance;
+				uSecond = uIndex;
+			}
+		} while (++uIndex<uColorCount);
+		if (uColorCount<2) {
+			uSecond = uBest;
+		}
+		pTable[uColor*2] = static_cast<Word8>(uBest);
+		pTable[uColor*2+1] = static_cast<Word8>(uSecond);
+	} while (++uColor<4096);
+}
+
+/***************************************
+
+	Process a PNG or PPM frame sequence into space ace format
+
+	Frames are numbered from uFirst until a file is missing
+
+***************************************/
+
+static Word ExtractVideoSequence(OutputMemoryStream *pOutput,const char *pPatternText,Word uFirst,const VideoSettings_t *pSettings)
+{
+	SequencePattern_t Pattern;
+	if (ParseSequencePattern(&Pattern,pPatternText)) {
+		return 10;
+	}
+
+	// Count the frames
+	char FileName[SEQUENCENAMESIZE];
+	WordPtr uFrameCount = 0;
+	for (;;) {
+		SequenceFileName(FileName,&Pattern,static_cast<Word>(uFirst+uFrameCount));
+		Filename TestName;
+		TestName.SetFromNative(FileName);
+		if (!FileManager::DoesFileExist(&TestName)) {
+			break;
+		}
+		++uFrameCount;
+	}
+	if (!uFrameCount) {
+		SequenceFileName(FileName,&Pattern,uFirst);
+		printf("Can't open %s!\n",FileName);
+		return 10;
+	}
+
+	WordPtr uThreadCount = pSettings->m_uThreadCount;
+	if (!uThreadCount) {
+		uThreadCount = 1;
+	} else if (uThreadCount>uFrameCount) {
+		uThreadCount = uFrameCount;
+	}
+
+	// Create the slots
+	Word uResult = 0;
+	Word8 ColorTable[4096*2];
+	Word8 IIgsPalette[32];
+	SequenceWorker_t *pWorkers = new SequenceWorker_t[uThreadCount];
+	WordPtr uIndex = 0;
+	do {
+		SequenceWorker_t *pWorker = &pWorkers[uIndex];
+		pWorker->m_pPattern = &Pattern;
+		pWorker->m_pColorTable = ColorTable;
+		pWorker->m_pPalette = IIgsPalette;
+		pWorker->m_pRGB = static_cast<Word8 *>(Alloc(320*200*3));
+		pWorker->m_pIndexes = static_cast<Word8 *>(Alloc(320*200));
+		pWorker->m_pFrame = static_cast<Word8 *>(Alloc(320*200/2));
+		pWorker->m_uFirst = uFirst;
+		pWorker->m_bDither = pSettings->m_bDither;
+		pWorker->m_uFrameCount = uFrameCount;
+		pWorker->m_uStart = uIndex;
+		pWorker->m_uStep = uThreadCount;
+		pWorker->m_uFrame = 0;
+		pWorker->m_bThreaded = FALSE;
+		pWorker->m_bQuit = FALSE;
+		pWorker->m_bPending = FALSE;
+		pWorker->m_uError = 0;
+		if (!pWorker->m_pRGB || !pWorker->m_pIndexes || !pWorker->m_pFrame) {
+			uResult = 10;
+		}
+	} while (++uIndex<uThreadCount);
+	if (uResult) {
+		printf("Out of memory\n");
+	}
+
+	// Count the colors, on the main thread if there's one
+	// thread or a thread couldn't be started
+	Word32 Histogram[4096];
+	MemoryClear(Histogram,sizeof(Histogram));
+	if (!uResult) {
+		uIndex = 0;
+		do {
+			SequenceWorker_t *pWorker = &pWorkers[uIndex];
+			if (uThreadCount>1) {
+				pWorker->m_bThreaded = !pWorker->m_Thread.Start(CountSequenceColors,pWorker);
+			}
+			if (!pWorker->m_bThreaded) {
+				CountSequenceColors(pWorker);
+			}
+		} while (++uIndex<uThreadCount);
+
+		uIndex = 0;
+		do {
+			SequenceWorker_t *pWorker = &pWorkers[uIndex];
+			if (pWorker->m_bThreaded) {
+				pWorker->m_Thread.Wait();
+				pWorker->m_bThreaded = FALSE;
+			}
+			uResult |= pWorker->m_uError;
+			Word uColor = 0;
+			do {
+				Histogram[uColor] += pWorker->m_Histogram[uColor];
+			} while (++uColor<4096);
+		} while (++uIndex<uThreadCount);
+	}
+
+	if (!uResult) {
+		Word uUsedColors = 0;
+		Word uColor = 0;
+		do {
+			if (Histogram[uColor]) {
+				++uUsedColors;
+			}
+		} while (++uColor<4096);
+
+		// One palette for the whole sequence
+		Word uColorCount = ChoosePalette(IIgsPalette,Histogram);
+		BuildColorTable(ColorTable,IIgsPalette,uColorCount);
+		printf("%u frames using %u of 4096 colors reduced to %u\n",
+			static_cast<Word>(uFrameCount),uUsedColors,uColorCount);
+
+		// Start the workers that map the frames
+		uIndex = 0;
+		do {
+			SequenceWorker_t *pWorker = &pWorkers[uIndex];
+			if (uThreadCount>1) {
+				pWorker->m_bThreaded = !pWorker->m_Thread.Start(MapSequenceWorker,pWorker);
+			}
+		} while (++uIndex<uThreadCount);
+
+		// Frame N is mapped by slot N modulo uThreadCount and the
+		// slot is compressed before it's reused, so the frames are
+		// compressed in order
+		VideoEncoder_t Encoder;
+		uResult = StartVideo(&Encoder,pOutput,pSettings);
+		WordPtr uFrame = 0;
+		uIndex = 0;
+		while (!uResult && (uFrame<uFrameCount)) {
+			SequenceWorker_t *pWorker = &pWorkers[uIndex];
+			uResult = FlushSequenceFrame(&Encoder,pWorker,IIgsPalette,TRUE);
+			if (!uResult) {
+				pWorker->m_uFrame = uFrame;
+				pWorker->m_bPending = TRUE;
+				if (pWorker->m_bThreaded) {
+					pWorker->m_Ready.Release();
+				} else {
+					MapSequenceFrame(pWorker);
+				}
+				++uFrame;
+				if (++uIndex==uThreadCount) {
+					uIndex = 0;
+				}
+			}
+		}
+
+		// Compress the rest of the frames in order and stop the workers
+		WordPtr uCount = uThreadCount;
+		do {
+			SequenceWorker_t *pWorker = &pWorkers[uIndex];
+			uResult |= FlushSequenceFrame(&Encoder,pWorker,IIgsPalette,!uResult);
+			if (pWorker->m_bThreaded) {
+				pWorker->m_bQuit = TRUE;
+				pWorker->m_Ready.Release();
+				pWorker->m_Thread.Wait();
+			}
+			if (++uIndex==uThreadCount) {
+				uIndex = 0;
+			}
+		} while (--uCount);
+		if (!uResult) {
+			FinishVideo(&Encoder);
+		}
+		ShutdownVideo(&Encoder);
+	}
+
+	uIndex = 0;
+	do {
+		Free(pWorkers[uIndex].m_pRGB);
+		Free(pWorkers[uIndex].m_pIndexes);
+		Free(pWorkers[uIndex].m_pFrame);
+	} while (++uIndex<uThreadCount);
+	delete [] pWorkers;
+	return uResult;
+}
+
+/***************************************
+
+	Return the number of CPU cores to encode with
+
+***************************************/
+
+static WordPtr BURGER_API GetCoreCount(void)
+{
+#if defined(BURGER_WINDOWS)
+	SYSTEM_INFO MyInfo;
+	GetSystemInfo(&MyInfo);
+	WordPtr uCount = MyInfo.dwNumberOfProcessors;
+#else
+	long iCount = sysconf(_SC_NPROCESSORS_ONLN);
+	WordPtr uCount = (iCount>0) ? static_cast<WordPtr>(iCount) : 1;
+#endif
+	if (!uCount) {
+		uCount = 1;
+	} else if (uCount>MAXTHREADS) {
+		uCount = MAXTHREADS;
+	}
+	return uCount;
+}
+
+/***************************************
+
+	State for packing LZW codes into GIF data sub-blocks
+
+***************************************/
+
+struct LZWOutput_t {
+	OutputMemoryStream *m_pOutput;	// Where the sub-blocks go
+	Word32 m_uBitBuffer;			// Bits not yet stored
+	Word m_uBitCount;				// Number of valid bits in m_uBitBuffer
+	Word m_uBlockSize;				// Number of bytes in m_Block
+	Word8 m_Block[255];				// Sub-block being built
+};
+
+static void BURGER_API LZWFlushBlock(LZWOutput_t *pLZW)
+{
+	if (pLZW->m_uBlockSize) {
+		pLZW->m_pOutput->Append(static_cast<Word8>(pLZW->m_uBlockSize));
+		pLZW->m_pOutput->Append(pLZW->m_Block,pLZW->m_uBlockSize);
+		pLZW->m_uBlockSize = 0;
+	}
+}
+
+static void BURGER_API LZWPutCode(LZWOutput_t *pLZW,Word uCode,Word uCodeSize)
+{
+	pLZW->m_uBitBuffer |= static_cast<Word32>(uCode)<<pLZW->m_uBitCount;
+	pLZW->m_uBitCount += uCodeSize;
+	while (pLZW->m_uBitCount>=8) {
+		pLZW->m_Block[pLZW->m_uBlockSize] = static_cast<Word8>(pLZW->m_uBitBuffer);
+		pLZW->m_uBitBuffer >>= 8U;
+		pLZW->m_uBitCount -= 8;
+		if (++pLZW->m_uBlockSize==sizeof(pLZW->m_Block)) {
+			LZWFlushBlock(pLZW);
+		}
+	}
+}
+
+/***************************************
+
+	LZW compress pixels into GIF image data
+
+	Uses a hashed string table, the table is cleared
+	when all 4096 codes are used.
+
+***************************************/
+
+#define LZWHASHSIZE 5003		// Prime larger than 4096
+
+static void BURGER_API CompressGIFLZW(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength,Word uMinCodeSize)
+{
+	Word32 HashKeys[LZWHASHSIZE];	// (Prefix<<8)+Suffix+1, zero if empty
+	Word16 HashCodes[LZWHASHSIZE];	// Code for the string
+	LZWOutput_t LZW;
+
+	LZW.m_pOutput = pOutput;
+	LZW.m_uBitBuffer = 0;
+	LZW.m_uBitCount = 0;
+	LZW.m_uBlockSize = 0;
+
+	pOutput->Append(static_cast<Word8>(uMinCodeSize));
+	Word uClearCode = 1U<<uMinCodeSize;
+	Word uCodeSize = uMinCodeSize+1;
+	Word uNextCode = uClearCode+2;
+	MemoryClear(HashKeys,sizeof(HashKeys));
+	LZWPutCode(&LZW,uClearCode,uCodeSize);
+
+	Word uPrefix = pInput[0];
+	while (--uInputLength) {
+		++pInput;
+		Word uSuffix = pInput[0];
+		Word32 uKey = (static_cast<Word32>(uPrefix)<<8U)+uSuffix+1;
+		WordPtr uHash = ((static_cast<WordPtr>(uSuffix)<<4U)^uPrefix)%LZWHASHSIZE;
+		while (HashKeys[uHash] && (HashKeys[uHash]!=uKey)) {
+			if (++uHash==LZWHASHSIZE) {
+				uHash = 0;
+			}
+		}
+		// Already in the table?
+		if (HashKeys[uHash]) {
+			uPrefix = HashCodes[uHash];
+			continue;
+		}
+		LZWPutCode(&LZW,uPrefix,uCodeSize);
+		if (uNextCode<4096) {
+			HashKeys[uHash] = uKey;
+			HashCodes[uHash] = static_cast<Word16>(uNextCode);
+			// The decoder widens the code when it adds this entry
+			if ((uNextCode==(1U<<uCodeSize)) && (uCodeSize<12)) {
+				++uCodeSize;
+			}
+			++uNextCode;
+		} else {
+			// Table is full, start over
+			LZWPutCode(&LZW,uClearCode,uCodeSize);
+			MemoryClear(HashKeys,sizeof(HashKeys));
+			uCodeSize = uMinCodeSize+1;
+			uNextCode = uClearCode+2;
+		}
+		uPrefix = uSuffix;
+	}
+	LZWPutCode(&LZW,uPrefix,uCodeSize);
+	LZWPutCode(&LZW,uClearCode+1,uCodeSize);
+	if (LZW.m_uBitCount) {
+		LZWPutCode(&LZW,0,8-LZW.m_uBitCount);
+	}
+	LZWFlushBlock(&LZW);
+	// End of image data
+	pOutput->Append(static_cast<Word8>(0));
+}
+
+/***************************************
+
+	A slot in the ring of frames waiting to be LZW encoded
+
+	Full frames are written by the slot's own FileGIF, started the
+	same way as the one on the main thread, so each frame block is
+	what a single FileGIF writes. The main thread's FileGIF writes
+	the header and the end of the file.
+
+	Delta frames are written by EncodeGIFDelta() with a local
+	palette. m_Pixels holds the rectangle of the screen to save with
+	unchanged pixels set to GIFTRANSPARENT.
+
+***************************************/
+
+#define GIFTRANSPARENT 16		// Unused palette entry for unchanged pixels
+
+struct GIFFrame_t {
+	Thread m_Thread;				// Worker encoding this slot's frames
+	Semaphore m_Ready;				// Released when a frame is ready to encode
+	Semaphore m_Done;				// Released when the frame is encoded
+	OutputMemoryStream m_Output;	// Encoded GIF frame block
+	Word m_bThreaded;				// TRUE if m_Thread is running
+	Word m_bQuit;					// TRUE to stop the worker
+	Word m_bPending;				// TRUE if m_Output hasn't been saved
+	Word m_bDelta;					// TRUE if m_Pixels holds a delta frame
+	Word m_uLeft;					// Rectangle of m_Pixels on the screen
+	Word m_uTop;
+	Word m_uWidth;
+	Word m_uHeight;
+	RGBAWord8_t m_Palette[32];		// Palette for this delta frame
+	FileGIF m_GIF;					// Encoder for full frames
+	Image m_Image;					// Full frame
+	Word8 m_Pixels[320*200];		// Cropped pixels of a delta frame
+};
+
+/***************************************
+
+	Copy a whole decoded frame into a slot
+
+***************************************/
+
+static void BURGER_API BuildGIFFrame(GIFFrame_t *pFrame,const Image *pCurrent,const RGBAWord8_t *pPalette)
+{
+	pFrame->m_bDelta = FALSE;
+	MemoryCopy(pFrame->m_GIF.GetPalette(),pPalette,sizeof(pPalette[0])*256);
+	MemoryCopy(pFrame->m_Image.GetImage(),pCurrent->GetImage(),320*200);
+}
+
+/***************************************
+
+	Crop a decoded frame to its dirty rect
+
+	Pixels that match the previous frame are made transparent
+	unless the palette changed. The dirty rect is then copied into
+	the previous frame.
+
+***************************************/
+
+static void BURGER_API BuildGIFDelta(GIFFrame_t *pFrame,const Word8 *pCurrent,Word8 *pPrevious,const DirtyRect_t *pDirty,Word bTransparent)
+{
+	pFrame->m_bDelta = TRUE;
+	// Nothing changed? Write a single transparent pixel to keep the timing
+	if ((pDirty->m_uRight<=pDirty->m_uLeft) || (pDirty->m_uBottom<=pDirty->m_uTop)) {
+		pFrame->m_uLeft = 0;
+		pFrame->m_uTop = 0;
+		pFrame->m_uWidth = 1;
+		pFrame->m_uHeight = 1;
+		pFrame->m_Pixels[0] = GIFTRANSPARENT;
+		return;
+	}
+
+	Word uWidth = pDirty->m_uRight-pDirty->m_uLeft;
+	Word uHeight = pDirty->m_uBottom-pDirty->m_uTop;
+	pFrame->m_uLeft = pDirty->m_uLeft;
+	pFrame->m_uTop = pDirty->m_uTop;
+	pFrame->m_uWidth = uWidth;
+	pFrame->m_uHeight = uHeight;
+
+	WordPtr uOffset = (pDirty->m_uTop*320)+pDirty->m_uLeft;
+	const Word8 *pSource = pCurrent+uOffset;
+	const Word8 *pOld = pPrevious+uOffset;
+	Word8 *pDest = pFrame->m_Pixels;
+	Word j = uHeight;
+	do {
+		Word i = 0;
+		do {
+			Word uColor = pSource[i];
+			if (bTransparent && (uColor==pOld[i])) {
+				uColor = GIFTRANSPARENT;
+			}
+			pDest[i] = static_cast<Word8>(uColor);
+		} while (++i<uWidth);
+		pSource+=320;
+		pOld+=320;
+		pDest+=uWidth;
+	} while (--j);
+
+	// Update the previous frame
+	MemoryCopy(pPrevious+(pDirty->m_uTop*320),pCurrent+(pDirty->m_uTop*320),uHeight*320);
+}
+
+/***************************************
+
+	LZW encode a delta frame into a GIF frame block with a
+	local palette
+
+***************************************/
+
+static void BURGER_API EncodeGIFDelta(GIFFrame_t *pFrame,Word uDelay)
+{
+	OutputMemoryStream *pOutput = &pFrame->m_Output;
+
+	// Graphic control extension, leave in place, with transparency
+	pOutput->Append(static_cast<Word8>(0x21));
+	pOutput->Append(static_cast<Word8>(0xF9));
+	pOutput->Append(static_cast<Word8>(4));
+	pOutput->Append(static_cast<Word8>(0x05));
+	pOutput->Append(static_cast<Word16>(uDelay));
+	pOutput->Append(static_cast<Word8>(GIFTRANSPARENT));
+	pOutput->Append(static_cast<Word8>(0));
+
+	// Image descriptor with a 32 color local palette
+	pOutput->Append(static_cast<Word8>(0x2C));
+	pOutput->Append(static_cast<Word16>(pFrame->m_uLeft));
+	pOutput->Append(static_cast<Word16>(pFrame->m_uTop));
+	pOutput->Append(static_cast<Word16>(pFrame->m_uWidth));
+	pOutput->Append(static_cast<Word16>(pFrame->m_uHeight));
+	pOutput->Append(static_cast<Word8>(0x84));
+	const RGBAWord8_t *pPalette = pFrame->m_Palette;
+	Word uIndex = 0;
+	do {
+		pOutput->Append(pPalette->m_uRed);
+		pOutput->Append(pPalette->m_uGreen);
+		pOutput->Append(pPalette->m_uBlue);
+		++pPalette;
+	} while (++uIndex<32);
+
+	CompressGIFLZW(pOutput,pFrame->m_Pixels,pFrame->m_uWidth*pFrame->m_uHeight,5);
+}
+
+/***************************************
+
+	LZW encode the frame in a slot
+
+***************************************/
+
+static void BURGER_API EncodeGIFFrame(GIFFrame_t *pFrame,Word uDelay)
+{
+	if (pFrame->m_bDelta) {
+		EncodeGIFDelta(pFrame,uDelay);
+	} else {
+		pFrame->m_GIF.AnimationSaveFrame(&pFrame->m_Output,&pFrame->m_Image,uDelay);
+	}
+}
+
+/***************************************
+
+	Worker thread that encodes the frames put in its slot
+
+***************************************/
+
+static WordPtr BURGER_API GIFWorker(void *pData)
+{
+	GIFFrame_t *pFrame = static_cast<GIFFrame_t *>(pData);
+	for (;;) {
+		pFrame->m_Ready.Acquire();
+		if (pFrame->m_bQuit) {
+			break;
+		}
+		EncodeGIFFrame(pFrame,(100U/8U));
+		pFrame->m_Done.Release();
+	}
+	return 0;
+}
+
+/***************************************
+
+	Wait for a slot's frame to finish encoding and append it to the output
+
+***************************************/
+
+static void BURGER_API FlushGIFFrame(OutputMemoryStream *pOutput,GIFFrame_t *pFrame)
+{
+	if (pFrame->m_bPending) {
+		if (pFrame->m_bThreaded) {
+			pFrame->m_Done.Acquire();
+		}
+		AppendStream(pOutput,&pFrame->m_Output);
+		pFrame->m_Output.Clear();
+		pFrame->m_bPending = FALSE;
+	}
+}
+
+/***************************************
+
+	Convert a Space Ace file to an animated GIF file
+
+	Chunks are decoded in order and frame N is handed to slot
+	N modulo uThreadCount, where a long lived worker LZW encodes it.
+	A slot is flushed before it's reused, so the encoded blocks are
+	appended in frame order.
+
+	With one thread, or if a worker couldn't be started, the frame
+	is encoded on the main thread instead. -t 1 is fully serial, so
+	its output can be compared to a threaded run. Full frames are
+	written by FileGIF, so the file is the same as one written
+	without threads.
+
+	If bDelta is set, each frame only contains the area the chunk
+	wrote to, with unchanged pixels set to transparent.
+
+***************************************/
+
+static char Name[] = "filexxx.gif";
+
+static Word EncapsulateToGIF(OutputMemoryStream *pOutput,const Word8 *pInput,WordPtr uInputLength,WordPtr uThreadCount,Word bDelta)
+{
+	// Too small?
+	if (uInputLength<2) {
+		return 10;
+	}
+
+	FileGIF GIF;
+	Image MyImage;
+
+	// Create an initial image
+	MyImage.Init(320,200,Image::PIXELTYPE8BIT);
+	MyImage.ClearBitmap();
+	MemoryClear(GIF.GetPalette(),sizeof(GIF.GetPalette()[0])*256);
+
+	// Create the ring of slots and their workers
+	GIFFrame_t *pFrames = new GIFFrame_t[uThreadCount];
+	Word bMemory = TRUE;
+	WordPtr uIndex = 0;
+	do {
+		GIFFrame_t *pFrame = &pFrames[uIndex];
+		pFrame->m_bQuit = FALSE;
+		pFrame->m_bPending = FALSE;
+		pFrame->m_bThreaded = FALSE;
+		if (pFrame->m_Image.Init(320,200,Image::PIXELTYPE8BIT)) {
+			bMemory = FALSE;
+		}
+		if (uThreadCount>1) {
+			pFrame->m_bThreaded = !pFrame->m_Thread.Start(GIFWorker,pFrame);
+		}
+	} while (++uIndex<uThreadCount);
+
+	// Frame as shown by the GIF for delta frames
+	Word8 *pPrevious = static_cast<Word8 *>(AllocClear(320*200));
+	DirtyRect_t Dirty;
+
+	//
+	// Decompress a chunk
+	//
+	Word uResult = 10;
+	Word uFrame = 0;
+	const Word8 *pWork;
+	WordPtr uChunkSize;
+	uIndex = 0;
+	if (!pPrevious || !bMemory) {
+		printf("Out of memory\n");
+	} else {
+		while (!(uResult = NextChunk(&pInput,&uInputLength,&pWork,&uChunkSize))) {
+			++uFrame;
+			ClearDirtyRect(&Dirty);
+			Word uType = UnpackChunk(&MyImage,GIF.GetPalette(),&Dirty,pWork,uChunkSize);
+
+			if (uFrame==1) {
+				GIF.AnimationSaveStart(pOutput,&MyImage);
+
+				// Start the slot encoders the same way, their headers aren't used
+				if (!bDelta) {
+					OutputMemoryStream Header;
+					WordPtr uSlot = 0;
+					do {
+						FileGIF *pGIF = &pFrames[uSlot].m_GIF;
+						MemoryCopy(pGIF->GetPalette(),GIF.GetPalette(),sizeof(GIF.GetPalette()[0])*256);
+						pGIF->AnimationSaveStart(&Header,&MyImage);
+						Header.Clear();
+					} while (++uSlot<uThreadCount);
+				}
+			}
+
+			// Save the frame that was last in this slot
+			GIFFrame_t *pFrame = &pFrames[uIndex];
+			FlushGIFFrame(pOutput,pFrame);
+
+			// Hand a copy of the frame and palette to the slot
+			MemoryCopy(pFrame->m_Palette,GIF.GetPalette(),sizeof(pFrame->m_Palette));
+			if (bDelta) {
+				if (uFrame==1) {
+					FillDirtyRect(&Dirty);
+				}
+				BuildGIFDelta(pFrame,MyImage.GetImage(),pPrevious,&Dirty,!(uType&0x80) && (uFrame!=1));
+			} else {
+				BuildGIFFrame(pFrame,&MyImage,GIF.GetPalette());
+			}
+			pFrame->m_bPending = TRUE;
+			if (pFrame->m_bThreaded) {
+				pFrame->m_Ready.Release();
+			} else {
+				EncodeGIFFrame(pFrame,(100U/8U));
+			}
+			if (++uIndex==uThreadCount) {
+				uIndex = 0;
+			}
+		}
+	}
+
+	// Save the rest of the frames in order and stop the workers
+	WordPtr uCount = uThreadCount;
+	do {
+		GIFFrame_t *pFrame = &pFrames[uIndex];
+		FlushGIFFrame(pOutput,pFrame);
+		if (pFrame->m_bThreaded) {
+			pFrame->m_bQuit = TRUE;
+			pFrame->m_Ready.Release();
+			pFrame->m_Thread.Wait();
+		}
+		if (++uIndex==uThreadCount) {
+			uIndex = 0;
+		}
+	} while (--uCount);
+	delete [] pFrames;
+	Free(pPrevious);
+
+	// End of data?
+	if (uResult==1) {
+		GIF.AnimationSaveFinish(pOutput);
+		uResult = 0;
+	}
+	return uResult;
+}
+
+/***************************************
+
+	Stream a Space Ace file as YUV4MPEG2 video
+
+	Each chunk is written as a 4:4:4 frame as soon as it's
+	decoded, at the 7.5 frames per second (8 ticks per frame)
+	the player uses.
+
+***************************************/
+
+static Word StreamToY4M(FILE *fp,const Word8 *pInput,WordPtr uInputLength)
+{
+	Image MyImage;
+	RGBAWord8_t Palette[256];
+	Word8 YUVTable[16*3];
+
+	MyImage.Init(320,200,Image::PIXELTYPE8BIT);
+	MyImage.ClearBitmap();
+	MemoryClear(Palette,sizeof(Palette));
+	MemoryClear(YUVTable,sizeof(YUVTable));
+	Word8 *pPlanes = static_cast<Word8 *>(Alloc(320*200*3));
+	if (!pPlanes) {
+		fprintf(stderr,"Out of memory\n");
+		return 10;
+	}
+
+	fprintf(fp,"YUV4MPEG2 W320 H200 F15:2 Ip A1:1 C444\n");
+
+	Word uResult;
+	const Word8 *pWork;
+	WordPtr uChunkSize;
+	while (!(uResult = NextChunk(&pInput,&uInputLength,&pWork,&uChunkSize))) {
+		if (UnpackChunk(&MyImage,Palette,NULL,pWork,uChunkSize)&0x80) {
+
+			// Convert the palette with BT.601 studio range
+			Word uIndex = 0;
+			do {
+				int iRed = Palette[uIndex].m_uRed;
+				int iGreen = Palette[uIndex].m_uGreen;
+				int iBlue = Palette[uIndex].m_uBlue;
+				YUVTable[uIndex] = static_cast<Word8>((((66*iRed)+(129*iGreen)+(25*iBlue)+128)>>8)+16);
+				YUVTable[uIndex+16] = static_cast<Word8>(((-38*iRed)-(74*iGreen)+(112*iBlue)+128+(128<<8))>>8);
+				YUVTable[uIndex+32] = static_cast<Word8>(((112*iRed)-(94*iGreen)-(18*iBlue)+128+(128<<8))>>8);
+			} while (++uIndex<16);
+		}
+
+		// Convert the pixels into the three planes
+		const Word8 *pPixels = MyImage.GetImage();
+		Word8 *pDest = pPlanes;
+		WordPtr i = 320*200;
+		do {
+			Word uColor = pPixels[0]&0xFU;
+			pDest[0] = YUVTable[uColor];
+			pDest[320*200] = YUVTable[uColor+16];
+			pDest[320*200*2] = YUVTable[uColor+32];
+			++pPixels;
+			++pDest;
+		} while (--i);
+
+		fputs("FRAME\n",fp);
+		if (fwrite(pPlanes,1,320*200*3,fp)!=(320*200*3)) {
+			// The player was closed
+			uResult = 10;
+			break;
+		}
+		fflush(fp);
+	}
+	Free(pPlanes);
+
+	// End of data?
+	if (uResult==1) {
+		uResult = 0;
+	}
+	return uResult;
+}
+
+/***************************************
+
+	Split a comma separated list in place
+
+	Returns the number of entries or zero if there are
+	more than MAXREFERENCES
+
+***************************************/
+
+static WordPtr BURGER_API SplitList(char **ppEntries,char *pList)
+{
+	WordPtr uCount = 0;
+	for (;;) {
+		if (uCount>=MAXREFERENCES) {
+			return 0;
+		}
+		ppEntries[uCount] = pList;
+		++uCount;
+		while (pList[0] && (pList[0]!=',')) {
+			++pList;
+		}
+		if (!pList[0]) {
+			break;
+		}
+		pList[0] = 0;
+		++pList;
+	}
+	return uCount;
+}
+
+/***************************************
+
+	Convert a list entry to a number from 1 to uMax
+
+	Returns zero if it isn't a number or out of range
+
+***************************************/
+
+static Word BURGER_API ListNumber(const char *pText,Word uMax)
+{
+	Word uValue = 0;
+	do {
+		Word uDigit = static_cast<Word>(pText[0]-'0');
+		if ((uDigit>=10U) || (uValue>uMax)) {
+			return 0;
+		}
+		uValue = (uValue*10U)+uDigit;
+	} while ((++pText)[0]);
+	if (uValue>uMax) {
+		return 0;
+	}
+	return uValue;
+}
+
+/***************************************
+
+	Load the movies of the -ref, -refscene and -refframe lists
+
+	Each list has one entry for every starting screen, or a
+	single entry shared by all of them. A movie named more than
+	once is only loaded once. Every loaded movie is stored
+	in ppMovies so the caller can free them.
+
+***************************************/
+
+static Word BURGER_API LoadReferences(ReferenceFrame_t *pOutput,WordPtr *pCount,Word8 **ppMovies,
+	const char *pNames,const char *pScenes,const char *pFrames)
+{
+	*pCount = 0;
+	if (!pScenes || !pScenes[0]) {
+		// No scene is file number 0, the chunk would never match
+		printf("-refscene is needed with -ref!\n");
+		return 10;
+	}
+	if (!pFrames || !pFrames[0]) {
+		printf("-refframe is needed with -ref!\n");
+		return 10;
+	}
+
+	// Make copies of the lists to split
+	WordPtr uNamesLength = StringLength(pNames)+1;
+	WordPtr uScenesLength = StringLength(pScenes)+1;
+	char *pBuffer = static_cast<char *>(Alloc(uNamesLength+uScenesLength+StringLength(pFrames)+1));
+	if (!pBuffer) {
+		printf("Out of memory\n");
+		return 10;
+	}
+	StringCopy(pBuffer,pNames);
+	StringCopy(pBuffer+uNamesLength,pScenes);
+	StringCopy(pBuffer+uNamesLength+uScenesLength,pFrames);
+
+	char *NameList[MAXREFERENCES];
+	char *SceneList[MAXREFERENCES];
+	char *FrameList[MAXREFERENCES];
+	WordPtr uNameCount = SplitList(NameList,pBuffer);
+	WordPtr uSceneCount = SplitList(SceneList,pBuffer+uNamesLength);
+	WordPtr uFrameCount = SplitList(FrameList,pBuffer+uNamesLength+uScenesLength);
+
+	// The longest list sets the count, the others must match or be single
+	WordPtr uCount = uNameCount;
+	if (uSceneCount>uCount) {
+		uCount = uSceneCount;
+	}
+	if (uFrameCount>uCount) {
+		uCount = uFrameCount;
+	}
+	Word uError = 0;
+	if (!uNameCount || !uSceneCount || !uFrameCount) {
+		printf("-ref can have %u starting screens at most!\n",MAXREFERENCES);
+		uError = 10;
+	} else if (((uNameCount!=1) && (uNameCount!=uCount)) ||
+		((uSceneCount!=1) && (uSceneCount!=uCount)) ||
+		((uFrameCount!=1) && (uFrameCount!=uCount))) {
+		printf("-ref, -refscene and -refframe need the same number of entries or a single one!\n");
+		uError = 10;
+	} else {
+		WordPtr uIndex = 0;
+		do {
+			const char *pSceneText = SceneList[(uSceneCount==1) ? 0 : uIndex];
+			const char *pFrameText = FrameList[(uFrameCount==1) ? 0 : uIndex];
+			pOutput[uIndex].m_uScene = ListNumber(pSceneText,255);
+			pOutput[uIndex].m_uFrame = ListNumber(pFrameText,65535);
+			if (!pOutput[uIndex].m_uScene) {
+				printf("-refscene %s isn't a scene from 1 to 255!\n",pSceneText);
+				uError = 10;
+				break;
+			}
+			if (!pOutput[uIndex].m_uFrame) {
+				printf("-refframe %s isn't a frame from 1 to 65535!\n",pFrameText);
+				uError = 10;
+				break;
+			}
+
+			// Only load each movie once
+			const char *pName = NameList[(uNameCount==1) ? 0 : uIndex];
+			WordPtr uMovie = 0;
+			while ((uMovie<uIndex) && StringCompare(NameList[(uNameCount==1) ? 0 : uMovie],pName)) {
+				++uMovie;
+			}
+			if (uMovie<uIndex) {
+				pOutput[uIndex].m_pMovie = pOutput[uMovie].m_pMovie;
+				pOutput[uIndex].m_uMovieLength = pOutput[uMovie].m_uMovieLength;
+			} else {
+				Filename MovieName;
+				MovieName.SetFromNative(pName);
+				Word8 *pMovie = static_cast<Word8 *>(FileManager::LoadFile(&MovieName,&pOutput[uIndex].m_uMovieLength));
+				if (!pMovie) {
+					printf("Can't open %s!\n",pName);
+					uError = 10;
+					break;
+				}
+				ppMovies[uIndex] = pMovie;
+				pOutput[uIndex].m_pMovie = pMovie;
+			}
+		} while (++uIndex<uCount);
+	}
+	Free(pBuffer);
+	*pCount = uCount;
+	return uError;
+}
+
+/***************************************
+
+	Main dispatcher
+
+***************************************/
+
+static const char *g_ThreadNames[] = {"t"};
+static const char *g_ReferenceNames[] = {"ref"};
+static const char *g_ReferenceSceneNames[] = {"refscene"};
+static const char *g_ReferenceFrameNames[] = {"refframe"};
+static const char *g_MaxChunkNames[] = {"b"};
+static const char *g_FirstFrameNames[] = {"first"};
+
+int BURGER_ANSIAPI main(int argc,const char **argv)
+{
+	ConsoleApp MyApp(argc,argv);
+	CommandParameterBooleanTrue DoVideo("Process Video","v");
+	CommandParameterBooleanTrue Version2("Use version 2 skip tokens","v2");
+	CommandParameterBooleanTrue LZKeyFrames("Try LZ copy tokens in keyframes","z");
+	CommandParameterWordPtr MaxChunkSize("Largest animation chunk in bytes, frames with a new palette can go over (0 = No limit)",g_MaxChunkNames,1,0,0,65535);
+	CommandParameterString Reference("Packed video files of the movies a death scene starts from, separated by commas",g_ReferenceNames,1);
+	CommandParameterString ReferenceScene("Scene numbers of the -ref movies, separated by commas",g_ReferenceSceneNames,1);
+	CommandParameterString ReferenceFrame("Frame counters of the -ref movies when the death scene starts, separated by commas",g_ReferenceFrameNames,1);
+	CommandParameterBooleanTrue ReferenceOnly("Drop the first picture, -ref must list every move into the death scene","refonly");
+	CommandParameterBooleanTrue Sequence("InputFile is a pattern of PNG or PPM frames with %d or %0Nd for the frame number","seq");
+	CommandParameterWordPtr FirstFrame("Number of the first -seq frame",g_FirstFrameNames,1,1,0,65535);
+	CommandParameterBooleanTrue Dither("Ordered dither -seq frames between their two nearest colors","dither");
+	CommandParameterBooleanTrue ConvertToGIF("Convert to GIF","g");
+	CommandParameterBooleanTrue DeltaGIF("Only save changed areas in the GIF","d");
+	CommandParameterBooleanTrue ConvertToY4M("Stream as YUV4MPEG2 video (- for stdout)","y4m");
+	CommandParameterWordPtr ThreadCount("Number of GIF encoder or -seq threads (0 = all cores)",g_ThreadNames,1,0,0,MAXTHREADS);
+	const CommandParameter *MyParms[] = {
+		&DoVideo,
+		&Version2,
+		&LZKeyFrames,
+		&MaxChunkSize,
+		&Reference,
+		&ReferenceScene,
+		&ReferenceFrame,
+		&ReferenceOnly,
+		&Sequence,
+		&FirstFrame,
+		&Dither,
+		&ConvertToGIF,
+		&DeltaGIF,
+		&ConvertToY4M,
+		&ThreadCount
+	};
+	argc = MyApp.GetArgc();
+	argv = MyApp.GetArgv();
+	argc = CommandParameter::Process(argc,argv,MyParms,sizeof(MyParms)/sizeof(MyParms[0]),
+		"Usage: packvideo InputFile OutputFile\n\n"
+		"Preprocess video data for Space Ace IIgs.\nCopyright by Rebecca Ann Heineman\n",3);
+	if (argc<0) {
+		Globals::SetErrorCode(10);
+	} else {
+		MyApp.SetArgc(argc);
+
+		Filename InputName;
+		InputName.SetFromNative(argv[1]);
+
+		// Frame sequences are loaded a frame at a time
+		WordPtr uInputLength = 0;
+		Word8 *pInput = NULL;
+		if (!Sequence.GetValue()) {
+			pInput = static_cast<Word8 *>(FileManager::LoadFile(&InputName,&uInputLength));
+		}
+		if (Sequence.GetValue() && !DoVideo.GetValue()) {
+			printf("-seq only works with -v!\n");
+			Globals::SetErrorCode(10);
+		} else if (!pInput && !Sequence.GetValue()) {
+			// Keep a -y4m stream on stdout clean
+			fprintf(ConvertToY4M.GetValue() ? stderr : stdout,"Can't open %s!\n",argv[1]);
 			Globals::SetErrorCode(10);
 		} else {
 
 			// Convert gif to data
 			if (DoVideo.GetValue()) {
 				OutputMemoryStream Output;
-				if (ExtractVideo(&Output,pInput,uInputLength)) {
-					printf("Can't convert %s!\n",argv[1]);
+				VideoSettings_t Settings;
+				ReferenceFrame_t References[MAXREFERENCES];
+				Word8 *Movies[MAXREFERENCES];
+				MemoryClear(Movies,sizeof(Movies));
+				Settings.m_pReferences = References;
+				Settings.m_uReferenceCount = 0;
+				Settings.m_bNoPicture = ReferenceOnly.GetValue();
+				Settings.m_uMaxChunkSize = MaxChunkSize.GetValue();
+				Settings.m_bVersion2 = Version2.GetValue();
+				Settings.m_bLZKeyFrames = LZKeyFrames.GetValue();
+				Settings.m_bDither = Dither.GetValue();
+				Settings.m_uThreadCount = ThreadCount.GetValue();
+				if (!Settings.m_uThreadCount) {
+					Settings.m_uThreadCount = GetCoreCount();
+				}
+
+				// Load the movies the death scene starts from
+				Word uError = 0;
+				const char *pReferenceName = Reference.GetValue();
+				if (pReferenceName && pReferenceName[0]) {
+					uError = LoadReferences(References,&Settings.m_uReferenceCount,Movies,
+						pReferenceName,ReferenceScene.GetValue(),ReferenceFrame.GetValue());
+				} else if (Settings.m_bNoPicture) {
+					printf("-refonly needs -ref!\n");
+					uError = 10;
+				}
+				if (Settings.m_uMaxChunkSize && (Settings.m_uMaxChunkSize<MINCHUNKSIZE)) {
+					printf("-b must be at least %u bytes!\n",MINCHUNKSIZE);
+					uError = 10;
+				}
+				if (!uError) {
+					if (Sequence.GetValue()) {
+						uError = ExtractVideoSequence(&Output,argv[1],static_cast<Word>(FirstFrame.GetValue()),&Settings);
+					} else {
+						uError = ExtractVideo(&Output,pInput,uInputLength,&Settings);
+					}
+					if (uError) {
+						printf("Can't convert %s!\n",argv[1]);
+					}
+				}
+				if (uError) {
 					Globals::SetErrorCode(10);
 				} else {
 					Filename OutputName;
@@ -583,11 +3098,19 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 						Globals::SetErrorCode(10);
 					}
 				}
+				WordPtr uMovie = 0;
+				do {
+					Free(Movies[uMovie]);
+				} while (++uMovie<MAXREFERENCES);
 				
 			// Convert raw video to GIF
 			} else if (ConvertToGIF.GetValue()) {
 				OutputMemoryStream Output;
-				if (EncapsulateToGIF(&Output,pInput,uInputLength)) {
+				WordPtr uThreadCount = ThreadCount.GetValue();
+				if (!uThreadCount) {
+					uThreadCount = GetCoreCount();
+				}
+				if (EncapsulateToGIF(&Output,pInput,uInputLength,uThreadCount,DeltaGIF.GetValue())) {
 					printf("Can't convert %s!\n",argv[1]);
 					Globals::SetErrorCode(10);
 				} else {
@@ -598,6 +3121,29 @@ int BURGER_ANSIAPI main(int argc,const char **argv)
 						Globals::SetErrorCode(10);
 					}
 				}
+			// Stream raw video as YUV4MPEG2
+			} else if (ConvertToY4M.GetValue()) {
+				FILE *fp;
+				if (!StringCompare(argv[2],"-")) {
+					fp = stdout;
+#if defined(BURGER_WINDOWS)
+					_setmode(_fileno(stdout),_O_BINARY);
+#endif
+				} else {
+					fp = fopen(argv[2],"wb");
+				}
+				if (!fp) {
+					fprintf(stderr,"Can't save %s!\n",argv[2]);
+					Globals::SetErrorCode(10);
+				} else {
+					if (StreamToY4M(fp,pInput,uInputLength)) {
+						fprintf(stderr,"Can't convert %s!\n",argv[1]);
+						Globals::SetErrorCode(10);
+					}
+					if (fp!=stdout) {
+						fclose(fp);
+					}
+				}
 			} else {
 				printf("No conversion selected for %s!\n",argv[1]);
 				Globals::SetErrorCode(10);